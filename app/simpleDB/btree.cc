@@ -393,7 +393,7 @@ BTree::BTree(BufferPool *buffer_pool): buffer_pool_(buffer_pool)
 {
   btree_node_num = 0;
   int file_size = buffer_pool_->GetFileSize();
-  if(file_size<=0) {
+  if(file_size <= buffer_pool_->HeaderSize()) {
     roots = btree_node_new();
   } else {
     char buf[4];
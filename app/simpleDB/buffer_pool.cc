@@ -28,7 +28,11 @@ void BufferPool::FlushPage(int page_id)
 }
 
 BufferPool::BufferPool(const std::string &db_path) : disk_manager_(new DiskManager(db_path)),
-    db_path_(db_path) {}
+    db_path_(db_path) {
+  if (!disk_manager_->EnableFreeSpaceMap(kMaxPages)) {
+    printf("%s has no free-space map, freed pages are not reused\n", db_path.c_str());
+  }
+}
 BufferPool::~BufferPool()
 {
   FlushAll();
@@ -45,17 +49,19 @@ void BufferPool::FlushAll()
   {
     FlushPage(p.first);
   }
+  disk_manager_->Sync();
 }
 char *BufferPool::NewPage(int &new_page_id)
 {
   int page_id = disk_manager_->AllocatePage();
   new_page_id = page_id;
   Page *page = GetPage(page_id);
-  return page->GetData();
+  return page == nullptr ? nullptr : page->GetData();
 }
 
 void BufferPool::FreePage(int page_id) {
   printf("delete page %d\n", page_id);
   delete pages_inmem_[page_id];
   pages_inmem_.erase(page_id);
+  disk_manager_->DeallocatePage(page_id);
 }
\ No newline at end of file
@@ -25,6 +25,14 @@ class BufferPool {
   int GetFileSize() {
     return disk_manager_->GetFileSize(db_path_);
   }
+  // bytes at the start of the file holding the free-space map
+  int HeaderSize() {
+    return disk_manager_->ReservedPages() * PAGE_SIZE;
+  }
+  // drop the free pages at the end of the file
+  void Trim() {
+    disk_manager_->Trim();
+  }
   uint32_t NextPageId() {
     return disk_manager_->NextPageId();
   }
@@ -20,6 +20,8 @@ class DB{
   }
   void Flush() {
     pool_->FlushAll();
+    // the trailer goes right after the last used page
+    pool_->Trim();
     char buf[4];
     EncodeFixed32(buf, btree_->root_id());
     pool_->AppendDisk(buf, 4);
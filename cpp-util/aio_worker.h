@@ -0,0 +1,369 @@
+/**
+ * batched Linux native AIO (io_submit), promoted from example/libaio.
+ * For direct I/O where io_uring is unavailable: requests come from a
+ * preallocated iocb pool, producers push them on a lock-free queue, and
+ * one worker thread submits whatever queued up with a single io_submit,
+ * reaps completions and runs their callbacks. The worker sleeps when
+ * there is nothing queued or in flight. With I/O in flight it blocks on
+ * an eventfd that completions (IOCB_FLAG_RESFD) and Submit both signal,
+ * so new requests go out without waiting for an earlier one to finish.
+ * The aio syscalls are called directly, no libaio needed. HAVE_LINUX_AIO
+ * is 0 where the kernel headers lack them, then Start always fails.
+ *
+ * O_DIRECT needs buffers, offsets and lengths aligned to the logical
+ * block size; AlignedBufferPool hands out kAlign (4KB) aligned buffers.
+ */
+#pragma once
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "concurrentqueue.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/aio_abi.h>)
+#define HAVE_LINUX_AIO 1
+#endif
+#endif
+#ifndef HAVE_LINUX_AIO
+#define HAVE_LINUX_AIO 0
+#endif
+
+#if HAVE_LINUX_AIO
+#include <linux/aio_abi.h>
+#endif
+
+// fixed number of equally sized, aligned buffers. Get/Put are lock free
+class AlignedBufferPool
+{
+public:
+  static constexpr size_t kAlign = 4096;
+
+  // buf_size is rounded up to kAlign
+  AlignedBufferPool(size_t count, size_t buf_size)
+      : buf_size_((buf_size + kAlign - 1) / kAlign * kAlign), count_(count)
+  {
+    if (posix_memalign((void **)&base_, kAlign, buf_size_ * count_) != 0)
+    {
+      base_ = nullptr;
+      count_ = 0;
+    }
+    for (size_t i = 0; i < count_; i++)
+    {
+      free_.enqueue(base_ + i * buf_size_);
+    }
+  }
+  ~AlignedBufferPool() { free(base_); }
+
+  AlignedBufferPool(const AlignedBufferPool &) = delete;
+  AlignedBufferPool &operator=(const AlignedBufferPool &) = delete;
+
+  // nullptr if every buffer is out
+  char *Get()
+  {
+    char *buf = nullptr;
+    return free_.try_dequeue(buf) ? buf : nullptr;
+  }
+  void Put(char *buf)
+  {
+    assert(buf >= base_ && buf < base_ + buf_size_ * count_);
+    free_.enqueue(buf);
+  }
+  size_t BufferSize() const { return buf_size_; }
+
+private:
+  char *base_ = nullptr;
+  const size_t buf_size_;
+  size_t count_;
+  moodycamel::ConcurrentQueue<char *> free_;
+};
+
+class AioWorker
+{
+public:
+  enum Op
+  {
+    kRead,
+    kWrite,
+  };
+  // res: bytes transferred or -errno
+  using Callback = std::function<void(long res)>;
+
+  // depth: I/Os in flight at most, also the size of the iocb pool
+  explicit AioWorker(int depth = 128) : depth_(depth), reqs_(depth)
+  {
+    for (Request &r : reqs_)
+    {
+      free_reqs_.enqueue(&r);
+    }
+  }
+  ~AioWorker() { Stop(); }
+
+  AioWorker(const AioWorker &) = delete;
+  AioWorker &operator=(const AioWorker &) = delete;
+
+  // false if native AIO is unavailable
+  bool Start()
+  {
+#if HAVE_LINUX_AIO
+    assert(worker_ == nullptr);
+    efd_ = eventfd(0, EFD_CLOEXEC);
+    if (efd_ < 0)
+    {
+      return false;
+    }
+    if (syscall(SYS_io_setup, depth_, &ctx_) != 0)
+    {
+      close(efd_);
+      efd_ = -1;
+      return false;
+    }
+    stop_ = false;
+    worker_ = new std::thread(&AioWorker::Loop, this);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // finishes the queued and in-flight I/Os first
+  void Stop()
+  {
+    if (worker_ == nullptr)
+    {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_->join();
+    delete worker_;
+    worker_ = nullptr;
+#if HAVE_LINUX_AIO
+    syscall(SYS_io_destroy, ctx_);
+    ctx_ = 0;
+    close(efd_);
+    efd_ = -1;
+#endif
+  }
+
+  // queue one I/O, cb runs on the worker thread when it completes. Blocks
+  // while all depth requests are in use. For O_DIRECT fds buf, len and
+  // off must be 512-byte aligned
+  void Submit(Op op, int fd, void *buf, size_t len, uint64_t off, Callback cb)
+  {
+    assert(worker_ != nullptr);
+    Request *req;
+    if (!free_reqs_.try_dequeue(req))
+    {
+      // every request is in use, Finish hands one back
+      std::unique_lock<std::mutex> l(free_mu_);
+      free_waiters_.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      free_cv_.wait(l, [&] { return free_reqs_.try_dequeue(req); });
+      free_waiters_.fetch_sub(1);
+    }
+    req->op = op;
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->off = off;
+    req->cb = std::move(cb);
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    queue_.enqueue(req);
+    // pairs with the fence in Loop: either we see it sleeping or it sees the request
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      cv_.notify_one();
+    }
+#if HAVE_LINUX_AIO
+    if (waiting_io_.load(std::memory_order_relaxed))
+    {
+      uint64_t one = 1;
+      ssize_t ret = write(efd_, &one, sizeof(one));
+      (void)ret;
+    }
+#endif
+  }
+
+  // submitted I/Os whose callbacks have not run yet
+  size_t Pending() const { return pending_.load(std::memory_order_acquire); }
+
+private:
+  struct Request
+  {
+#if HAVE_LINUX_AIO
+    struct iocb cb_;
+#endif
+    Op op;
+    int fd;
+    void *buf;
+    size_t len;
+    uint64_t off;
+    Callback cb;
+  };
+
+#if HAVE_LINUX_AIO
+  void Loop()
+  {
+    std::vector<Request *> batch(depth_);
+    std::vector<struct iocb *> iocbs(depth_);
+    std::vector<struct io_event> events(depth_);
+    int inflight = 0;
+    while (true)
+    {
+      // everything queued so far goes out with one io_submit
+      size_t n = queue_.try_dequeue_bulk(batch.data(), depth_ - inflight);
+      for (size_t i = 0; i < n; i++)
+      {
+        iocbs[i] = Prepare(batch[i]);
+      }
+      size_t done = 0;
+      while (done < n)
+      {
+        long ret = syscall(SYS_io_submit, ctx_, n - done, &iocbs[done]);
+        if (ret < 0 && errno == EAGAIN)
+        {
+          std::this_thread::yield();
+          continue;
+        }
+        if (ret < 0)
+        {
+          // rejected, report it and drop the request
+          Finish((Request *)(uintptr_t)iocbs[done]->aio_data, -errno);
+          done++;
+          continue;
+        }
+        done += ret;
+        inflight += ret;
+      }
+      if (inflight > 0)
+      {
+        // nothing new can go out: the queue is empty, or every slot is in
+        // flight. Block until a completion or a Submit, then reap
+        if (inflight == depth_ || queue_.size_approx() == 0)
+        {
+          WaitEvent(inflight == depth_);
+        }
+        struct timespec ts = {0, 0};
+        long ret;
+        do
+        {
+          ret = syscall(SYS_io_getevents, ctx_, 0, depth_, events.data(), &ts);
+        } while (ret < 0 && errno == EINTR);
+        for (long i = 0; i < ret; i++)
+        {
+          Finish((Request *)(uintptr_t)events[i].data, events[i].res);
+        }
+        inflight -= ret > 0 ? ret : 0;
+        continue;
+      }
+      if (queue_.size_approx() > 0)
+      {
+        continue;
+      }
+      // idle: sleep until Submit or Stop
+      std::unique_lock<std::mutex> l(mu_);
+      sleeping_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      cv_.wait_for(l, std::chrono::milliseconds(100),
+                   [this] { return stop_ || queue_.size_approx() > 0; });
+      sleeping_.store(false, std::memory_order_relaxed);
+      if (stop_ && queue_.size_approx() == 0)
+      {
+        return;
+      }
+    }
+  }
+
+  // full: only a completion can help, a queued request has to wait
+  void WaitEvent(bool full)
+  {
+    waiting_io_.store(true, std::memory_order_relaxed);
+    // pairs with the fence in Submit: either it sees us waiting or we see
+    // its request
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (full || queue_.size_approx() == 0)
+    {
+      uint64_t count;
+      while (read(efd_, &count, sizeof(count)) < 0 && errno == EINTR)
+      {
+      }
+    }
+    waiting_io_.store(false, std::memory_order_relaxed);
+  }
+
+  struct iocb *Prepare(Request *req)
+  {
+    struct iocb *cb = &req->cb_;
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_data = (uint64_t)(uintptr_t)req;
+    cb->aio_lio_opcode = req->op == kRead ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+    cb->aio_fildes = req->fd;
+    cb->aio_buf = (uint64_t)(uintptr_t)req->buf;
+    cb->aio_nbytes = req->len;
+    cb->aio_offset = req->off;
+    // the completion wakes WaitEvent
+    cb->aio_flags = IOCB_FLAG_RESFD;
+    cb->aio_resfd = efd_;
+    return cb;
+  }
+#else
+  void Loop() {}
+#endif
+
+  void Finish(Request *req, long res)
+  {
+    Callback cb = std::move(req->cb);
+    req->cb = nullptr;
+    free_reqs_.enqueue(req);
+    // pairs with the fence in Submit: either it sees the request or we see
+    // it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (free_waiters_.load(std::memory_order_relaxed) > 0)
+    {
+      std::lock_guard<std::mutex> l(free_mu_);
+      free_cv_.notify_one();
+    }
+    if (cb)
+    {
+      cb(res);
+    }
+    pending_.fetch_sub(1, std::memory_order_release);
+  }
+
+  const int depth_;
+  std::vector<Request> reqs_; // the iocb pool
+  moodycamel::ConcurrentQueue<Request *> free_reqs_;
+  moodycamel::ConcurrentQueue<Request *> queue_; // waiting for io_submit
+  std::atomic<size_t> pending_{0};
+#if HAVE_LINUX_AIO
+  aio_context_t ctx_ = 0;
+  int efd_ = -1;                      // completions and Submit signal it
+  std::atomic<bool> waiting_io_{false}; // the worker blocks on efd_
+#endif
+  std::thread *worker_ = nullptr;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_ = false;               // guarded by mu_
+  std::atomic<bool> sleeping_{false};
+  // Submit waits here while every request is in use
+  std::mutex free_mu_;
+  std::condition_variable free_cv_;
+  std::atomic<int> free_waiters_{0};
+};
@@ -125,4 +125,61 @@ class FixedArena : public Arena {
   int32_t fixed_size_;
 };
 
+// FixedArena for many sizes, learn from slab: a request is rounded up to a
+// size class (kSlabAlign steps up to kMaxSlab) and a freed block goes to the
+// free list of its class, linked through the block itself, so steady state
+// alloc/free never reach malloc. Bigger requests use malloc/free directly.
+// The caller passes the requested size back to FreeSlab.
+class SlabArena : public Arena {
+  public:
+  static const size_t kSlabAlign = 16;
+  static const size_t kMaxSlab = 512;
+
+  SlabArena() : free_bytes_(0) {
+    for (size_t i = 0; i < kNumClasses; i++) {
+      free_list_[i] = nullptr;
+    }
+  }
+  ~SlabArena() = default;
+
+  char *AllocateSlab(size_t bytes) {
+    assert(bytes > 0);
+    if (bytes > kMaxSlab) {
+      return (char*)malloc(bytes);
+    }
+    const size_t c = SizeClass(bytes);
+    FreeBlock *b = free_list_[c];
+    if (b != nullptr) {
+      free_list_[c] = b->next;
+      free_bytes_ -= ClassSize(c);
+      return (char*)b;
+    }
+    return AllocateAligned(ClassSize(c));
+  }
+  void FreeSlab(char *ptr, size_t bytes) {
+    if (bytes > kMaxSlab) {
+      free(ptr);
+      return;
+    }
+    const size_t c = SizeClass(bytes);
+    FreeBlock *b = (FreeBlock*)ptr;
+    b->next = free_list_[c];
+    free_list_[c] = b;
+    free_bytes_ += ClassSize(c);
+  }
+  // bytes parked in the free lists
+  size_t FreeBytes() const { return free_bytes_; }
+
+  private:
+  static const size_t kNumClasses = kMaxSlab / kSlabAlign;
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+  static size_t SizeClass(size_t bytes) { return (bytes - 1) / kSlabAlign; }
+  static size_t ClassSize(size_t c) { return (c + 1) * kSlabAlign; }
+
+  FreeBlock *free_list_[kNumClasses];
+  size_t free_bytes_;
+};
+
 #endif  // _ARENA_H_
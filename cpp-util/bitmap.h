@@ -25,9 +25,10 @@ public:
     return true;
   }
 
-  // return the first free position of bitmap, return -1 if full
-  int FirstFreePos() const {
-    for (uint32_t i = 0; i < n64_; i++) {
+  // return the first free position of bitmap, return -1 if full.
+  // from_word: skip the words below, known to be full
+  int FirstFreePos(uint32_t from_word = 0) const {
+    for (uint32_t i = from_word; i < n64_; i++) {
       //ffsl return 0 means has no 1, otherwise return pos(1-64)
       int ffp = ffsl(~data_[i]) - 1;
       if (ffp != -1) {
@@ -37,6 +38,26 @@ public:
     return -1;
   }
 
+  // return the last used position, return -1 if empty
+  int LastSetPos() const {
+    for (int i = (int)n64_ - 1; i >= 0; i--) {
+      uint64_t w = data_[i];
+      // padding bits past bits_ are always set
+      if (i == (int)n64_ - 1 && bits_ % 64 != 0) {
+        w &= (1ULL << (bits_ % 64)) - 1;
+      }
+      if (w != 0) {
+        return i * 64 + 63 - __builtin_clzll(w);
+      }
+    }
+    return -1;
+  }
+
+  // raw words, bit i lives in word i / 64, for persisting the bitmap
+  uint64_t *Data() { return data_; }
+  uint32_t Words() const { return n64_; }
+  uint32_t Size() const { return bits_; }
+
   bool Test(uint32_t index) const {
     assert(index < bits_);
     int n = index / 64;
@@ -103,8 +124,8 @@ public:
     reset();
   }
   lfbitset_base(volatile uint64_t *bitword, uint64_t Nbits)
-      : bitword(bitword), widx(0), _Nbits(Nbits), align_N((Nbits + 63) / 64),
-        self_alloc(false) {
+      : widx(0), _Nbits(Nbits), align_N((Nbits + 63) / 64), self_alloc(false),
+        bitword(bitword) {
     reset();
   }
   ~lfbitset_base() {
@@ -140,7 +161,7 @@ public:
     if (tail == 0) {
       return ~bitword[align_N - 1] != 0;
     } else {
-      return bitword[align_N - 1] != (1L << tail) - 1;
+      return bitword[align_N - 1] != (1UL << tail) - 1;
     }
   }
   bool all() const {
@@ -152,7 +173,7 @@ public:
     if (tail == 0) {
       return ~bitword[align_N - 1] == 0;
     } else {
-      return bitword[align_N - 1] == (1L << tail) - 1;
+      return bitword[align_N - 1] == (1UL << tail) - 1;
     }
   }
   bool test(uint64_t __i) const {
@@ -296,8 +317,9 @@ public:
       return ffs_and_set();
     uint64_t w = bitword;
     uint64_t mask = (n == 64) ? ~0UL : ((1L << n) - 1);
+    const uint64_t last = 64 - n; // the highest start of n free bits
     uint64_t idx = 0;
-    while (idx <= 64 - n) {
+    while (idx <= last) {
       int first_0 = ffsl((~w) >> idx);
       if (first_0 == 0) {
         return -1;
@@ -305,7 +327,7 @@ public:
       int first_1_after_0 = ffsl(w >> (idx + first_0));
       if (first_1_after_0 != 0 && first_1_after_0 < n) {
         idx += first_0 + first_1_after_0;
-      } else if (idx + first_0 - 1 > 64 - n) {
+      } else if (idx + first_0 - 1 > last) {
         return -1;
       } else if (__atomic_compare_exchange_n(
                      &bitword, &w, w | (mask << (idx + first_0 - 1)), true,
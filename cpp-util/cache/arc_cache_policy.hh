@@ -0,0 +1,136 @@
+#ifndef ARC_CACHE_POLICY_HH
+#define ARC_CACHE_POLICY_HH
+
+#include "cache_policy.hh"
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+// Adaptive Replacement Cache (Megiddo & Modha). Resident keys are split
+// into t1 (seen once recently) and t2 (seen at least twice); evicted keys
+// are remembered in the ghost lists b1/b2. A miss that hits b1 means t1 was
+// too small and grows the target size p of t1, a hit in b2 shrinks it, so
+// the split between recency and frequency tunes itself.
+//
+// The policy does not see which key is about to come in when the cache
+// asks for ReplCandidate, so REPLACE only compares |t1| with p.
+// capacity 0: use the largest resident count seen, which is the cache size
+// once fixed_sized_cache is full.
+template <typename Key>
+class ARCCachePolicy : public ICachePolicy<Key>
+{
+public:
+  explicit ARCCachePolicy(size_t capacity = 0) : capacity(capacity), fixed(capacity != 0) {}
+  ~ARCCachePolicy() override = default;
+
+  // the lists hold iterators, a copy starts empty
+  ARCCachePolicy(const ARCCachePolicy &other) : ARCCachePolicy(other.fixed ? other.capacity : 0) {}
+  ARCCachePolicy &operator=(const ARCCachePolicy &) = delete;
+
+  void Insert(const Key &key) override
+  {
+    auto it = key_finder.find(key);
+    if (it == key_finder.end())
+    {
+      // brand new key
+      lists[T1].emplace_front(key);
+      key_finder.emplace(key, Entry{T1, lists[T1].begin()});
+    }
+    else
+    {
+      Entry &e = it->second;
+      assert(e.list == B1 || e.list == B2);
+      const size_t b1 = lists[B1].size(), b2 = lists[B2].size();
+      if (e.list == B1)
+      {
+        // recency would have hit, favour t1
+        size_t delta = b1 >= b2 ? 1 : b2 / b1;
+        p = p + delta > capacity ? capacity : p + delta;
+      }
+      else
+      {
+        size_t delta = b2 >= b1 ? 1 : b1 / b2;
+        p = p > delta ? p - delta : 0;
+      }
+      Move(e, T2);
+    }
+    if (!fixed && lists[T1].size() + lists[T2].size() > capacity)
+    {
+      capacity = lists[T1].size() + lists[T2].size();
+    }
+    TrimGhosts();
+  }
+
+  void Touch(const Key &key) override
+  {
+    auto it = key_finder.find(key);
+    assert(it != key_finder.end() && (it->second.list == T1 || it->second.list == T2));
+    Move(it->second, T2);
+  }
+
+  // an erased key is remembered as a ghost of the list it left
+  void Erase(const Key &key) override
+  {
+    auto it = key_finder.find(key);
+    Entry &e = it->second;
+    assert(e.list == T1 || e.list == T2);
+    Move(e, e.list == T1 ? B1 : B2);
+    TrimGhosts();
+  }
+
+  const Key &ReplCandidate() const override
+  {
+    const std::list<Key> &t1 = lists[T1];
+    if (!t1.empty() && (t1.size() > p || lists[T2].empty()))
+    {
+      return t1.back();
+    }
+    return lists[T2].back();
+  }
+
+  // current target size of t1, for tests and tuning
+  size_t Target() const { return p; }
+
+private:
+  enum ListId { T1, T2, B1, B2, kLists };
+  struct Entry
+  {
+    ListId list;
+    typename std::list<Key>::iterator pos;
+  };
+
+  // to the MRU end of list `to`
+  void Move(Entry &e, ListId to)
+  {
+    lists[to].splice(lists[to].begin(), lists[e.list], e.pos);
+    e.list = to;
+  }
+
+  void DropLRU(ListId id)
+  {
+    key_finder.erase(lists[id].back());
+    lists[id].pop_back();
+  }
+
+  // |t1| + |b1| <= c and the whole directory <= 2c
+  void TrimGhosts()
+  {
+    while (!lists[B1].empty() && lists[T1].size() + lists[B1].size() > capacity)
+    {
+      DropLRU(B1);
+    }
+    while (!lists[B2].empty() && key_finder.size() > 2 * capacity)
+    {
+      DropLRU(B2);
+    }
+  }
+
+  size_t capacity;
+  const bool fixed;
+  size_t p = 0; // target size of t1
+  std::list<Key> lists[kLists];
+  std::unordered_map<Key, Entry> key_finder;
+};
+
+#endif
@@ -85,15 +85,18 @@ public:
       return nullptr;
     }
 
-    auto elem_it = Erase(key);
-    return elem_it->second;
+    // copy out first, Erase invalidates the iterator
+    const Value value = FindElem(key)->second;
+    Erase(key);
+    return value;
   }
 
   const Value Evict()
   {
     auto disp_candidate_key = cache_policy.ReplCandidate();
-    auto elem_it = Erase(disp_candidate_key);
-    return elem_it->second;
+    const Value value = FindElem(disp_candidate_key)->second;
+    Erase(disp_candidate_key);
+    return value;
   }
 
   size_t AggregatedMinHits(size_t num_elements)
@@ -0,0 +1,47 @@
+#ifndef FIFO_CACHE_POLICY_HH
+#define FIFO_CACHE_POLICY_HH
+
+#include "cache_policy.hh"
+#include <list>
+#include <unordered_map>
+
+// fifo policy evicts in insertion order, touching a key changes nothing
+template <typename Key>
+class FIFOCachePolicy : public ICachePolicy<Key>
+{
+public:
+  using fifo_iterator = typename std::list<Key>::const_iterator;
+
+  FIFOCachePolicy() = default;
+  ~FIFOCachePolicy() = default;
+
+  void Insert(const Key &key) override
+  {
+    fifo_queue.emplace_front(key);
+    key_lookup[key] = fifo_queue.begin();
+  }
+
+  void Touch(const Key &key) override
+  {
+    // nothing to do here in the FIFO strategy
+    (void)key;
+  }
+
+  void Erase(const Key &key) override
+  {
+    auto element = key_lookup[key];
+    fifo_queue.erase(element);
+    key_lookup.erase(key);
+  }
+
+  // return a key of a displacement candidate
+  const Key &ReplCandidate() const override
+  {
+    return fifo_queue.back();
+  }
+
+private:
+  std::list<Key> fifo_queue;
+  std::unordered_map<Key, fifo_iterator> key_lookup;
+};
+#endif
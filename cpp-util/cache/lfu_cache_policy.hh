@@ -2,79 +2,197 @@
 #define LFU_CACHE_POLICY_HH
 
 #include "cache_policy.hh"
+#include <cassert>
 #include <cstddef>
-#include <iostream>
-#include <map>
+#include <deque>
 #include <unordered_map>
 
+// O(1) LFU: a list of frequency buckets in ascending order, each bucket
+// holds the keys with that frequency oldest first. Touch moves a key to the
+// bucket of frequency + 1, which is the next bucket or a new one right
+// after it. Key and bucket nodes come from pools, so Touch never allocates.
 template <typename Key>
 class LFUCachePolicy : public ICachePolicy<Key>
 {
 public:
-  using lfu_iterator = typename std::multimap<std::size_t, Key>::iterator;
-
-  LFUCachePolicy() = default;
+  LFUCachePolicy()
+  {
+    freq_head.prev = freq_head.next = &freq_head;
+  }
   ~LFUCachePolicy() override = default;
 
+  // pointers into the pools would dangle in a copy
+  LFUCachePolicy(const LFUCachePolicy &) : LFUCachePolicy() {}
+  LFUCachePolicy &operator=(const LFUCachePolicy &) = delete;
+
   void Insert(const Key &key) override
   {
-    constexpr std::size_t INIT_VAL = 1;
     // all new value initialized with the frequency 1
-    lfu_storage[key] = frequency_storage.emplace_hint(requency_storage.cbegin(), INIT_VAL, key);
+    FreqNode *bucket = freq_head.next;
+    if (bucket == &freq_head || bucket->freq != 1)
+    {
+      bucket = NewBucket(1, &freq_head);
+    }
+    KeyNode *node = NewKey(key);
+    PushBack(bucket, node);
+    lfu_storage[key] = node;
   }
 
   void Touch(const Key &key) override
   {
-    // get the previous frequency value of a key
-    auto elem_for_update = lfu_storage[key];
-    auto updated_elem =
-        std::make_pair(elem_for_update->first + 1, elem_for_update->second);
-    // update the previous value
-    frequency_storage.erase(elem_for_update);
-    lfu_storage[key] = frequency_storage.emplace_hint(
-        frequency_storage.cend(), std::move(updated_elem));
+    KeyNode *node = lfu_storage[key];
+    FreqNode *bucket = node->bucket;
+    FreqNode *next = bucket->next;
+    if (next == &freq_head || next->freq != bucket->freq + 1)
+    {
+      next = NewBucket(bucket->freq + 1, bucket);
+    }
+    Unlink(node);
+    PushBack(next, node);
+    if (bucket->first == nullptr)
+    {
+      FreeBucket(bucket);
+    }
   }
 
-
   void Erase(const Key &key) override
   {
-    frequency_storage.erase(lfu_storage[key]);
-    lfu_storage.erase(key);
+    auto it = lfu_storage.find(key);
+    KeyNode *node = it->second;
+    FreqNode *bucket = node->bucket;
+    Unlink(node);
+    if (bucket->first == nullptr)
+    {
+      FreeBucket(bucket);
+    }
+    node->next = free_keys;
+    free_keys = node;
+    lfu_storage.erase(it);
   }
 
   const Key &ReplCandidate() const override
   {
-    // at the beginning of the frequency_storage we have the
-    // least frequency used value
-    return frequency_storage.cbegin()->second;
+    // the oldest key of the least frequent bucket
+    assert(freq_head.next != &freq_head);
+    return freq_head.next->first->key;
   }
 
-  size_t SumMinHits(uint64_t num_elements) override
+  // sum of the hits of the num_elements least used keys,
+  // UINT64_MAX if there are fewer keys
+  size_t SumMinHits(uint64_t num_elements)
   {
     uint64_t iterCounter = 0;
     size_t sumHits = 0;
-
-    for (auto it = frequency_storage.begin(); it != frequency_storage.end(); it++)
+    for (FreqNode *b = freq_head.next; b != &freq_head && iterCounter < num_elements; b = b->next)
     {
-      sumHits += it->first;
-      iterCounter++;
-      if (num_elements == iterCounter)
-        break;
+      for (KeyNode *n = b->first; n != nullptr && iterCounter < num_elements; n = n->next)
+      {
+        sumHits += b->freq;
+        iterCounter++;
+      }
     }
-
-    // printf("[%s] sumHits = %lu\n", __func__, sumHits);
     return (iterCounter == num_elements) ? sumHits : UINT64_MAX;
   }
 
-  size_t Hits(const Key &key) override
+  size_t Hits(const Key &key)
   {
-    auto elem_it = lfu_storage[key];
-    return elem_it->first;
+    return lfu_storage[key]->bucket->freq;
   }
 
 private:
-  std::multimap<std::size_t, Key> frequency_storage;//ordered by frequency
-  std::unordered_map<Key, lfu_iterator> lfu_storage;
+  struct FreqNode;
+  struct KeyNode
+  {
+    Key key;
+    KeyNode *prev;
+    KeyNode *next;
+    FreqNode *bucket;
+  };
+  struct FreqNode
+  {
+    size_t freq;
+    FreqNode *prev;
+    FreqNode *next;
+    KeyNode *first; // oldest, the eviction candidate of the bucket
+    KeyNode *last;
+  };
+
+  KeyNode *NewKey(const Key &key)
+  {
+    KeyNode *node = free_keys;
+    if (node != nullptr)
+    {
+      free_keys = node->next;
+      node->key = key;
+    }
+    else
+    {
+      key_pool.push_back(KeyNode{key, nullptr, nullptr, nullptr});
+      node = &key_pool.back();
+    }
+    return node;
+  }
+
+  // link a new bucket after pos
+  FreqNode *NewBucket(size_t freq, FreqNode *pos)
+  {
+    FreqNode *bucket = free_buckets;
+    if (bucket != nullptr)
+    {
+      free_buckets = bucket->next;
+    }
+    else
+    {
+      bucket_pool.emplace_back();
+      bucket = &bucket_pool.back();
+    }
+    bucket->freq = freq;
+    bucket->first = bucket->last = nullptr;
+    bucket->prev = pos;
+    bucket->next = pos->next;
+    pos->next->prev = bucket;
+    pos->next = bucket;
+    return bucket;
+  }
+
+  void FreeBucket(FreqNode *bucket)
+  {
+    bucket->prev->next = bucket->next;
+    bucket->next->prev = bucket->prev;
+    bucket->next = free_buckets;
+    free_buckets = bucket;
+  }
+
+  static void PushBack(FreqNode *bucket, KeyNode *node)
+  {
+    node->bucket = bucket;
+    node->next = nullptr;
+    node->prev = bucket->last;
+    if (bucket->last != nullptr)
+    {
+      bucket->last->next = node;
+    }
+    else
+    {
+      bucket->first = node;
+    }
+    bucket->last = node;
+  }
+
+  static void Unlink(KeyNode *node)
+  {
+    FreqNode *bucket = node->bucket;
+    (node->prev != nullptr ? node->prev->next : bucket->first) = node->next;
+    (node->next != nullptr ? node->next->prev : bucket->last) = node->prev;
+  }
+
+  FreqNode freq_head; // sentinel of the bucket list, ordered by frequency
+  std::unordered_map<Key, KeyNode *> lfu_storage;
+  // deque never moves its elements, freed nodes are chained through next
+  std::deque<KeyNode> key_pool;
+  std::deque<FreqNode> bucket_pool;
+  KeyNode *free_keys = nullptr;
+  FreqNode *free_buckets = nullptr;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,93 @@
+#ifndef SHARDED_CACHE_HH
+#define SHARDED_CACHE_HH
+
+#include "cache.hh"
+#include "lock.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// thread safe fixed_sized_cache: keys are spread over shards by hash, each
+// shard owns its map and policy instance and is guarded by its own stripe
+// of a Striped lock, so threads working on different shards never contend.
+// Eviction is per shard, each holds max_size / shards entries.
+template <typename Key, typename Value, typename Policy = NoCachePolicy<Key>,
+          typename Hash = std::hash<Key>>
+class sharded_fixed_sized_cache
+{
+public:
+  using Shard = fixed_sized_cache<Key, Value, Policy>;
+  using Callback = typename Shard::Callback;
+  using operation_guard = typename std::lock_guard<std::mutex>;
+
+  explicit sharded_fixed_sized_cache(size_t max_size, size_t shards = 16,
+      Callback OnErase = [](const Key &, const Value &) {})
+      : hash_(Hash()),
+        locks_(shards, [this](const Key &key) { return Slot(key); })
+  {
+    const size_t per_shard = max_size == 0 ? 0 : (max_size + shards - 1) / shards;
+    for (size_t i = 0; i < shards; i++)
+    {
+      shards_.emplace_back(new Shard(per_shard, OnErase));
+    }
+  }
+
+  void Put(const Key &key, const Value &value)
+  {
+    operation_guard lock{*locks_.get(key)};
+    GetShard(key).Put(key, value);
+  }
+
+  bool Get(const Key &key, Value &value) const
+  {
+    operation_guard lock{*locks_.get(key)};
+    return GetShard(key).Get(key, value);
+  }
+
+  bool Cached(const Key &key) const
+  {
+    operation_guard lock{*locks_.get(key)};
+    return GetShard(key).Cached(key);
+  }
+
+  const Value Remove(const Key &key)
+  {
+    operation_guard lock{*locks_.get(key)};
+    return GetShard(key).Remove(key);
+  }
+
+  // sum of the shard sizes, not a consistent snapshot under writes
+  size_t Size() const
+  {
+    size_t size = 0;
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      operation_guard lock{*locks_.at(i)};
+      size += shards_[i]->Size();
+    }
+    return size;
+  }
+
+  void Clear()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      operation_guard lock{*locks_.at(i)};
+      shards_[i]->Clear();
+    }
+  }
+
+private:
+  // stripe i guards shard i, both picked by hash % shards
+  uint64_t Slot(const Key &key) const { return hash_(key); }
+  Shard &GetShard(const Key &key) const { return *shards_[hash_(key) % shards_.size()]; }
+
+  Hash hash_;
+  mutable Striped<std::mutex, Key> locks_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif
@@ -1,12 +1,76 @@
 #include "cache.hh"
 #include "lru_cache_policy.hh"
+#include "lfu_cache_policy.hh"
+#include "fifo_cache_policy.hh"
+#include "sharded_cache.hh"
+#include "arc_cache_policy.hh"
+#include "two_queue_cache_policy.hh"
 #include "timer.h"
 #include "cassert"
 #include "lrucache_stl.hh"
 #include "lrucache.h"
+#include <random>
+#include <thread>
+#include <vector>
 using CacheT = fixed_sized_cache<int64_t,int64_t,LRUCachePolicy<int64_t>>;
+using LFUCacheT = fixed_sized_cache<int64_t,int64_t,LFUCachePolicy<int64_t>>;
 const int N = 1'000'000;
 int64_t dataa[N];
+// kThreads readers sharing one cache, each key lives in the cache
+template <typename Policy>
+void TestSharded(const char *name) {
+  const int kThreads = 4;
+  const int kKeys = 1024;
+  sharded_fixed_sized_cache<int64_t, int64_t, Policy> cache(kKeys * 2);
+  for (int i = 0; i < kKeys; ++i) {
+    cache.Put(i, i);
+  }
+  std::vector<std::thread> threads;
+  Timer t;
+  for (int n = 0; n < kThreads; ++n) {
+    threads.emplace_back([&cache, n]() {
+      for (int i = 0; i < N; ++i) {
+        int64_t key = (i + n) % kKeys, val;
+        bool hit = cache.Get(key, val);
+        assert(hit && val == key);
+        (void)hit;
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  printf("sharded %s cache, %d threads Get IOPS: %fMops\n", name, kThreads, kThreads * N / t.GetDurationUs());
+  assert(cache.Size() == kKeys);
+  // overflow evicts per shard
+  for (int i = kKeys; i < kKeys * 4; ++i) {
+    cache.Put(i, i);
+  }
+  assert(cache.Size() <= kKeys * 2 + 16);
+  assert(cache.Cached(kKeys * 4 - 1));
+  cache.Clear();
+  assert(cache.Size() == 0);
+}
+
+// skewed hot keys mixed with a never ending scan
+template <typename Policy>
+void HitRatio(const char *name) {
+  fixed_sized_cache<int64_t, int64_t, Policy> cache(100);
+  std::mt19937 rnd(301);
+  int64_t hits = 0, scan = 1000;
+  const int kOps = 200000;
+  for (int i = 0; i < kOps; ++i) {
+    int64_t key = (i % 2 == 0) ? (rnd() % 200) * (rnd() % 200) / 200 : scan++;
+    int64_t val;
+    if (cache.Get(key, val)) {
+      hits++;
+    } else {
+      cache.Put(key, key);
+    }
+  }
+  printf("%s hit ratio: %.3f\n", name, (double)hits / kOps);
+}
+
 int main() {
   CacheT *cache = new CacheT(2);
   cache->Put(1, 1);
@@ -21,6 +85,53 @@ int main() {
   assert(cache->Get(3,val));
   assert(3 == val);
   
+  // ----------test lfu-------------
+  LFUCacheT *lfu = new LFUCacheT(3);
+  lfu->Put(1, 1);
+  lfu->Put(2, 2);
+  lfu->Put(3, 3);
+  assert(lfu->Get(1,val));
+  assert(lfu->Get(1,val));
+  assert(lfu->Get(3,val));
+  assert(lfu->hitCounter(1) == 3);
+  assert(lfu->AggregatedMinHits(2) == 1 + 2);
+  // 2 is the least frequently used
+  lfu->Put(4, 4);
+  assert(lfu->Cached(2) == false);
+  // 4 and 3 tie on frequency with 3 older, 4 has the lowest count
+  lfu->Put(5, 5);
+  assert(lfu->Cached(4) == false);
+  assert(lfu->Cached(1) && lfu->Cached(3) && lfu->Cached(5));
+
+  // ----------test arc/2q-------------
+  // keys hit twice move to t2 and survive a scan through t1
+  fixed_sized_cache<int64_t, int64_t, ARCCachePolicy<int64_t>> arc(4);
+  arc.Put(1, 1);
+  arc.Put(2, 2);
+  assert(arc.Get(1,val) && arc.Get(2,val));
+  for (int i = 100; i < 120; ++i) {
+    arc.Put(i, i);
+  }
+  assert(arc.Cached(1) && arc.Cached(2) && arc.Cached(119));
+  // 118 was evicted to b1, coming back grows t1's target
+  arc.Put(118, 118);
+  assert(arc.Cached(118));
+  // 1 returns from the ghost list a1out to am, then survives a scan
+  fixed_sized_cache<int64_t, int64_t, TwoQueueCachePolicy<int64_t>> twoq(8);
+  for (int i = 1; i <= 9; ++i) {
+    twoq.Put(i, i);
+  }
+  assert(twoq.Cached(1) == false);
+  twoq.Put(1, 1);
+  for (int i = 100; i < 200; ++i) {
+    twoq.Put(i, i);
+  }
+  assert(twoq.Cached(1) && twoq.Cached(199));
+  HitRatio<LRUCachePolicy<int64_t>>("lru");
+  HitRatio<LFUCachePolicy<int64_t>>("lfu");
+  HitRatio<ARCCachePolicy<int64_t>>("arc");
+  HitRatio<TwoQueueCachePolicy<int64_t>>("2q");
+
   // ----------test performance-------------
   CacheT *cache2 = new CacheT(1024);
   Timer t;
@@ -31,6 +142,15 @@ int main() {
     assert(val == i);
   }
   printf("policy cache IOPS: %fMops\n", N/t.GetDurationUs());
+  LFUCacheT *lfu2 = new LFUCacheT(1024);
+  t.Reset();
+  for(int i=0; i<N; ++i) {
+    lfu2->Put(i, i);
+    int64_t val;
+    assert(lfu2->Get(i, val) == true);
+    assert(val == i);
+  }
+  printf("lfu policy cache IOPS: %fMops\n", N/t.GetDurationUs());
   lru_cache<int64_t,int64_t> *lru = new lru_cache<int64_t,int64_t>(1024);
   t.Reset();
   for(int i=0; i<N; ++i) {
@@ -51,6 +171,9 @@ int main() {
     cache3->Release(handle);
   }
   printf("mycache IOPS: %fMops\n", N/t.GetDurationUs());
+  TestSharded<LRUCachePolicy<int64_t>>("lru");
+  TestSharded<FIFOCachePolicy<int64_t>>("fifo");
+  TestSharded<LFUCachePolicy<int64_t>>("lfu");
   return 0;
 }
 
@@ -0,0 +1,109 @@
+#ifndef TWO_QUEUE_CACHE_POLICY_HH
+#define TWO_QUEUE_CACHE_POLICY_HH
+
+#include "cache_policy.hh"
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+// 2Q (Johnson & Shasha, full version). A new key enters the FIFO a1in; when
+// it is evicted from there its key is kept in the ghost FIFO a1out. Only a
+// key that comes back while in a1out is admitted to the LRU am, so keys
+// seen once (scans) never push out the hot set.
+// a1in holds about 25% of the cache and a1out remembers 50% more keys.
+// capacity 0: use the largest resident count seen, see ARCCachePolicy.
+template <typename Key>
+class TwoQueueCachePolicy : public ICachePolicy<Key>
+{
+public:
+  explicit TwoQueueCachePolicy(size_t capacity = 0) : capacity(capacity), fixed(capacity != 0) {}
+  ~TwoQueueCachePolicy() override = default;
+
+  // the lists hold iterators, a copy starts empty
+  TwoQueueCachePolicy(const TwoQueueCachePolicy &other)
+      : TwoQueueCachePolicy(other.fixed ? other.capacity : 0) {}
+  TwoQueueCachePolicy &operator=(const TwoQueueCachePolicy &) = delete;
+
+  void Insert(const Key &key) override
+  {
+    auto it = key_finder.find(key);
+    if (it != key_finder.end())
+    {
+      // seen again soon after it left a1in, it is hot
+      assert(it->second.list == A1OUT);
+      Move(it->second, AM);
+    }
+    else
+    {
+      lists[A1IN].emplace_front(key);
+      key_finder.emplace(key, Entry{A1IN, lists[A1IN].begin()});
+    }
+    if (!fixed && lists[A1IN].size() + lists[AM].size() > capacity)
+    {
+      capacity = lists[A1IN].size() + lists[AM].size();
+    }
+  }
+
+  void Touch(const Key &key) override
+  {
+    Entry &e = key_finder.find(key)->second;
+    if (e.list == AM)
+    {
+      Move(e, AM);
+    }
+    // a hit in a1in changes nothing, correlated references do not count
+  }
+
+  void Erase(const Key &key) override
+  {
+    auto it = key_finder.find(key);
+    if (it->second.list == A1IN)
+    {
+      Move(it->second, A1OUT);
+      const size_t kout = capacity / 2 > 0 ? capacity / 2 : 1;
+      while (lists[A1OUT].size() > kout)
+      {
+        key_finder.erase(lists[A1OUT].back());
+        lists[A1OUT].pop_back();
+      }
+    }
+    else
+    {
+      assert(it->second.list == AM);
+      lists[AM].erase(it->second.pos);
+      key_finder.erase(it);
+    }
+  }
+
+  const Key &ReplCandidate() const override
+  {
+    const size_t kin = capacity / 4 > 0 ? capacity / 4 : 1;
+    if (!lists[A1IN].empty() && (lists[A1IN].size() > kin || lists[AM].empty()))
+    {
+      return lists[A1IN].back();
+    }
+    return lists[AM].back();
+  }
+
+private:
+  enum ListId { A1IN, A1OUT, AM, kLists };
+  struct Entry
+  {
+    ListId list;
+    typename std::list<Key>::iterator pos;
+  };
+
+  void Move(Entry &e, ListId to)
+  {
+    lists[to].splice(lists[to].begin(), lists[e.list], e.pos);
+    e.list = to;
+  }
+
+  size_t capacity;
+  const bool fixed;
+  std::list<Key> lists[kLists];
+  std::unordered_map<Key, Entry> key_finder;
+};
+
+#endif
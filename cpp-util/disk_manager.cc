@@ -1,15 +1,90 @@
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <thread> // NOLINT
+#include <vector>
 
+#include "bitmap.h"
 #include "disk_manager.h"
 
 static char *buffer_used;
 
-DiskManager::DiskManager(const std::string &db_file)
+static bool Aligned(const void *buf, off_t offset, size_t size)
+{
+    return ((uintptr_t)buf | (uintptr_t)offset | size) % kDirectIOAlign == 0;
+}
+
+// O_DIRECT staging for a page buffer that is not aligned
+static char *BounceBuffer()
+{
+    alignas(kDirectIOAlign) static thread_local char bounce[PAGE_SIZE];
+    return bounce;
+}
+
+// free-space map image in the reserved pages: header, then the bitmap words
+struct FsmHeader
+{
+    uint64_t magic;
+    uint32_t max_pages;
+    uint32_t pages;
+};
+static const uint64_t kFsmMagic = 0x50414d4545524646ULL; // "FFREEMAP"
+static const size_t kFsmHeaderSize = 64;
+
+// pwrite/pread until done, retrying short transfers and EINTR
+static bool PwriteAll(int fd, const char *buf, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t ret = pwrite(fd, buf, size, offset);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buf += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+// return the bytes read, less than size at the end of the file, -1 on error
+static ssize_t PreadAll(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t ret = pread(fd, buf + done, size - done, offset + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+DiskManager::DiskManager(const std::string &db_file, bool direct_io)
     : file_name_(db_file), next_page_id_(0), num_flushes_(0), num_writes_(0), flush_log_(false), flush_log_f_(nullptr)
 {
     std::string::size_type n = file_name_.rfind('.');
@@ -31,95 +106,633 @@ DiskManager::DiskManager(const std::string &db_file)
             throw "can't open dblog file";
         }
     }
-    db_io_.open(db_file, std::ios::binary | std::ios::in | std::ios::out);
-    if (!db_io_.is_open())
+    // create a new file if needed
+    if (direct_io)
     {
-        db_io_.clear();
-        // create a new file
-        db_io_.open(db_file, std::ios::binary | std::ios::trunc | std::ios::out);
-        db_io_.close();
-        db_io_.open(db_file, std::ios::binary | std::ios::in | std::ios::out);
-        if (!db_io_.is_open())
-        {
-            throw "can't open db file";
-        }
+        db_fd_ = open(db_file.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+        // EINVAL: the filesystem has no direct I/O, e.g. tmpfs
+        direct_io_ = db_fd_ >= 0;
+    }
+    if (db_fd_ < 0)
+    {
+        db_fd_ = open(db_file.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+    if (db_fd_ < 0)
+    {
+        throw "can't open db file";
     }
     buffer_used = nullptr;
 }
 
+DiskManager::~DiskManager()
+{
+    // callbacks of queued I/Os still run
+    while (PendingIO() > 0)
+    {
+        PollIO(1);
+    }
+    if (db_fd_ >= 0)
+    {
+        FlushFreeSpaceMap();
+        close(db_fd_);
+    }
+    if (fsm_ != nullptr)
+    {
+        FreeBitmap(fsm_);
+    }
+}
 
-void DiskManager::WritePage(uint32_t page_id, const char *page_data)
+bool DiskManager::WritePage(uint32_t page_id, const char *page_data)
 {
-    size_t offset = (size_t)page_id * PAGE_SIZE;
+    off_t offset = (off_t)page_id * PAGE_SIZE;
     num_writes_ += 1;
-    db_io_.seekp(offset);
-    db_io_.write(page_data, PAGE_SIZE);
-    if (db_io_.bad())
+    if (direct_io_ && !Aligned(page_data, 0, 0))
+    {
+        page_data = (const char *)memcpy(BounceBuffer(), page_data, PAGE_SIZE);
+    }
+    if (!PwriteAll(db_fd_, page_data, PAGE_SIZE, offset))
     {
         std::cerr << "WritePage failed" << std::endl;
-        return;
+        return false;
     }
-    db_io_.flush();
+    return true;
+}
+
+bool DiskManager::WritePages(uint32_t first_page_id, char *const *pages, size_t n)
+{
+    assert(n > 0 && n <= IOV_MAX);
+    if (direct_io_)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!Aligned(pages[i], 0, 0))
+            {
+                // WritePage bounces the unaligned ones
+                bool ok = true;
+                for (size_t j = 0; j < n; j++)
+                {
+                    ok = WritePage(first_page_id + j, pages[j]) && ok;
+                }
+                return ok;
+            }
+        }
+    }
+    std::vector<struct iovec> iov(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        iov[i].iov_base = pages[i];
+        iov[i].iov_len = PAGE_SIZE;
+    }
+    off_t offset = (off_t)first_page_id * PAGE_SIZE;
+    size_t left = n * PAGE_SIZE;
+    size_t done = 0;
+    size_t idx = 0; // iov[idx] is the first entry not fully written
+    num_writes_ += 1;
+    while (left > 0)
+    {
+        ssize_t ret = pwritev(db_fd_, &iov[idx], n - idx, offset + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "WritePages failed" << std::endl;
+            return false;
+        }
+        done += ret;
+        left -= ret;
+        // skip what a short write already wrote
+        size_t skip = ret;
+        while (idx < n && skip >= iov[idx].iov_len)
+        {
+            skip -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx < n)
+        {
+            iov[idx].iov_base = (char *)iov[idx].iov_base + skip;
+            iov[idx].iov_len -= skip;
+        }
+    }
+    return true;
 }
 
 void DiskManager::Append(const char *buf, size_t size)
 {
+    std::lock_guard<std::mutex> guard(append_latch_);
     num_writes_ += 1;
-    db_io_.seekp(GetFileSize(file_name_));
-    db_io_.write(buf, size);
-    if (db_io_.bad())
+    struct stat st;
+    if (fstat(db_fd_, &st) != 0 || (direct_io_ && !Aligned(buf, st.st_size, size)))
     {
-        std::cerr << "Append fail" << std::endl;
+        std::cerr << "Append fail, O_DIRECT needs " << kDirectIOAlign << "B aligned buffer, offset and size" << std::endl;
         return;
     }
-    db_io_.flush();
+    if (!PwriteAll(db_fd_, buf, size, st.st_size))
+    {
+        std::cerr << "Append fail" << std::endl;
+    }
 }
 
 void DiskManager::ReadPage(uint32_t page_id, char *page_data)
 {
-    int offset = page_id * PAGE_SIZE;
-    int file_size = GetFileSize(file_name_);
-    if (offset > file_size)
+    off_t offset = (off_t)page_id * PAGE_SIZE;
+    char *dst = page_data;
+    if (direct_io_ && !Aligned(page_data, 0, 0))
+    {
+        dst = BounceBuffer();
+    }
+    ssize_t read_count = PreadAll(db_fd_, dst, PAGE_SIZE, offset);
+    if (read_count < 0)
     {
-        printf("load File failed, read offset %d while filesize %d B\n", offset, file_size);
+        std::cerr << "ReadPage failed" << std::endl;
+        return;
+    }
+    if (dst != page_data)
+    {
+        memcpy(page_data, dst, read_count);
+    }
+    // if file ends before reading PAGE_SIZE
+    if (read_count < PAGE_SIZE)
+    {
+        memset(page_data + read_count, 0, PAGE_SIZE - read_count);
+    }
+}
+
+bool DiskManager::Sync()
+{
+    FlushFreeSpaceMap();
+    return fdatasync(db_fd_) == 0;
+}
+
+bool DiskManager::EnableFreeSpaceMap(uint32_t max_pages)
+{
+    assert(fsm_ == nullptr);
+    Bitmap *map = NewBitmap(max_pages);
+    size_t bytes = map->Words() * sizeof(uint64_t);
+    uint32_t pages = (kFsmHeaderSize + bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    struct stat st;
+    if (max_pages <= pages || max_pages > INT_MAX || fstat(db_fd_, &st) != 0)
+    {
+        FreeBitmap(map);
+        return false;
+    }
+    bool load = st.st_size > 0;
+    if (load)
+    {
+        std::vector<char> image((size_t)pages * PAGE_SIZE);
+        for (uint32_t i = 0; i < pages; i++)
+        {
+            ReadPage(i, image.data() + (size_t)i * PAGE_SIZE);
+        }
+        FsmHeader header;
+        memcpy(&header, image.data(), sizeof(header));
+        if (header.magic != kFsmMagic || header.max_pages != max_pages || header.pages != pages)
+        {
+            FreeBitmap(map);
+            return false;
+        }
+        memcpy(map->Data(), image.data() + kFsmHeaderSize, bytes);
     }
     else
     {
-        db_io_.seekp(offset);
-        db_io_.read(page_data, PAGE_SIZE);
-        if (db_io_.bad())
+        for (uint32_t i = 0; i < pages; i++)
         {
-            return;
+            map->Set(i);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(fsm_latch_);
+        fsm_ = map;
+        fsm_pages_ = pages;
+        fsm_hint_ = 0;
+        fsm_dirty_.assign(pages, !load);
+        next_page_id_ = map->LastSetPos() + 1;
+    }
+    // a new file gets its map right away, so it is never mistaken for a
+    // file without one
+    FlushFreeSpaceMap();
+    return true;
+}
+
+uint32_t DiskManager::AllocatePage()
+{
+    if (fsm_ == nullptr)
+    {
+        return next_page_id_++;
+    }
+    std::lock_guard<std::mutex> guard(fsm_latch_);
+    int pos = fsm_->FirstFreePos(fsm_hint_);
+    if (pos < 0)
+    {
+        fsm_hint_ = fsm_->Words();
+        return INVALID_PAGE_ID;
+    }
+    // words before pos are full until a page below is freed
+    fsm_hint_ = pos / 64;
+    fsm_->Set(pos);
+    fsm_dirty_[(kFsmHeaderSize + fsm_hint_ * sizeof(uint64_t)) / PAGE_SIZE] = true;
+    if ((uint32_t)pos >= next_page_id_)
+    {
+        next_page_id_ = pos + 1;
+    }
+    return pos;
+}
+
+void DiskManager::DeallocatePage(uint32_t page_id)
+{
+    if (fsm_ == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(fsm_latch_);
+    if (page_id < fsm_pages_ || page_id >= fsm_->Size() || !fsm_->Test(page_id))
+    {
+        std::cerr << "DeallocatePage: page " << page_id << " is not in use" << std::endl;
+        return;
+    }
+    fsm_->Reset(page_id);
+    fsm_hint_ = std::min(fsm_hint_, page_id / 64);
+    fsm_dirty_[(kFsmHeaderSize + page_id / 64 * sizeof(uint64_t)) / PAGE_SIZE] = true;
+}
+
+uint32_t DiskManager::Trim()
+{
+    if (fsm_ == nullptr)
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(fsm_latch_);
+    uint32_t end = fsm_->LastSetPos() + 1;
+    next_page_id_ = end;
+    off_t size = (off_t)end * PAGE_SIZE;
+    struct stat st;
+    if (fstat(db_fd_, &st) != 0 || st.st_size <= size)
+    {
+        return 0;
+    }
+    if (ftruncate(db_fd_, size) != 0)
+    {
+        std::cerr << "Trim failed" << std::endl;
+        return 0;
+    }
+    return (st.st_size - size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+void DiskManager::FlushFreeSpaceMap()
+{
+    if (fsm_ == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(fsm_latch_);
+    const char *words = (const char *)fsm_->Data();
+    size_t end = kFsmHeaderSize + fsm_->Words() * sizeof(uint64_t);
+    for (uint32_t i = 0; i < fsm_pages_; i++)
+    {
+        if (!fsm_dirty_[i])
+        {
+            continue;
         }
-        // if file ends before reading PAGE_SIZE
-        int read_count = db_io_.gcount();
-        if (read_count < PAGE_SIZE)
+        // aligned, so WritePage writes it in place under O_DIRECT
+        char *buf = BounceBuffer();
+        memset(buf, 0, PAGE_SIZE);
+        size_t begin = (size_t)i * PAGE_SIZE;
+        if (i == 0)
         {
-            db_io_.clear();
-            std::cerr << "Read less than a page" << std::endl;
-            memset(page_data + read_count, 0, PAGE_SIZE - read_count);
+            FsmHeader header = {kFsmMagic, fsm_->Size(), fsm_pages_};
+            memcpy(buf, &header, sizeof(header));
         }
+        size_t lo = std::max(begin, kFsmHeaderSize);
+        size_t hi = std::min(begin + PAGE_SIZE, end);
+        memcpy(buf + (lo - begin), words + (lo - kFsmHeaderSize), hi - lo);
+        WritePage(i, buf);
+        fsm_dirty_[i] = false;
     }
 }
 
-void DiskManager::Read(char *buf, int offset, size_t size)
+bool DiskManager::EnableAsyncIO(unsigned depth, bool sqpoll)
+{
+    std::lock_guard<std::mutex> guard(uring_latch_);
+    assert(!uring_.Ready());
+    // before 5.11 SQPOLL needs CAP_SYS_ADMIN and registered files, drop
+    // to plain submission if the ring cannot be set up or read db_fd_.
+    // Before 5.6 a plain ring sets up but has no IORING_OP_READ/WRITE, stay
+    // inline then
+    if (!(sqpoll && uring_.Init(depth, true) && ProbeRingLocked()) &&
+        !(uring_.Init(depth) && ProbeRingLocked()))
+    {
+        return false;
+    }
+    slots_.resize(uring_.Depth());
+    for (uint32_t i = 0; i < slots_.size(); i++)
+    {
+        free_slots_.push_back(i);
+    }
+    return true;
+}
+
+bool DiskManager::ProbeRingLocked()
 {
-    int file_size = GetFileSize(file_name_);
-    if (offset > file_size)
+    // an SQPOLL ring that cannot use db_fd_ fails the read with -EBADF, a
+    // kernel without IORING_OP_READ with -EINVAL
+    uint64_t slot;
+    int res = -EIO;
+    bool ok = uring_.Prep(IoUring::kRead, db_fd_, BounceBuffer(), PAGE_SIZE, 0, 0) && uring_.Submit(1) >= 0 &&
+              uring_.Peek(&slot, &res) && res >= 0;
+    if (!ok)
     {
-        printf("load File failed, read offset %d while filesize %d B\n", offset, file_size);
+        uring_.Close();
     }
-    else
+    return ok;
+}
+
+bool DiskManager::SubmitLocked(std::unique_lock<std::mutex> &guard)
+{
+    int ret = uring_.Submit();
+    // -EAGAIN/-EBUSY: out of resources or completions, reaping makes room
+    if (ret >= 0 || ret == -EAGAIN || ret == -EBUSY)
+    {
+        return true;
+    }
+    // a waiter may still be in the kernel on this ring, let it return first
+    uint64_t resets = ring_resets_;
+    reaped_cv_.wait(guard, [this] { return !waiting_; });
+    if (resets == ring_resets_)
+    {
+        ResetRingLocked(ret);
+    }
+    return false;
+}
+
+void DiskManager::WaitLocked(std::unique_lock<std::mutex> &guard, size_t wait_nr)
+{
+    if (waiting_)
+    {
+        // the waiter reaps for everyone
+        reaped_cv_.wait(guard, [this] { return !waiting_; });
+        return;
+    }
+    // only what the kernel has, nobody else reaps until we are back
+    wait_nr = std::min(wait_nr, inflight_ - uring_.Unsubmitted());
+    if (wait_nr == 0)
     {
-        db_io_.seekp(offset);
-        db_io_.read(buf, size);
-        if (db_io_.bad())
+        return;
+    }
+    waiting_ = true;
+    guard.unlock();
+    int ret = uring_.Wait(wait_nr);
+    guard.lock();
+    waiting_ = false;
+    ReapLocked(&completed_);
+    reaped_cv_.notify_all();
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+    {
+        ResetRingLocked(ret);
+    }
+}
+
+void DiskManager::ResetRingLocked(int err)
+{
+    ReapLocked(&completed_);
+    std::vector<bool> busy(slots_.size(), true);
+    for (uint32_t slot : free_slots_)
+    {
+        busy[slot] = false;
+    }
+    bool sqpoll = uring_.SqPoll();
+    // the kernel may still be working on them, their buffers are lost
+    uring_.Close();
+    for (uint32_t slot = 0; slot < slots_.size(); slot++)
+    {
+        if (busy[slot])
+        {
+            completed_.emplace_back(std::move(slots_[slot].cb), err);
+            slots_[slot].cb = nullptr;
+            free_slots_.push_back(slot);
+        }
+    }
+    inflight_ = 0;
+    ring_resets_++;
+    std::cerr << "io_uring failed: " << strerror(-err) << std::endl;
+    // retry without SQPOLL, otherwise the async calls run inline from now on
+    if (sqpoll && uring_.Init(slots_.size()) && uring_.Depth() == slots_.size())
+    {
+        if (!registered_.empty() && !uring_.RegisterBuffers(registered_.data(), registered_.size()))
+        {
+            registered_.clear();
+        }
+        return;
+    }
+    uring_.Close();
+    registered_.clear();
+    slots_.clear();
+    free_slots_.clear();
+}
+
+bool DiskManager::AsyncIOEnabled()
+{
+    std::lock_guard<std::mutex> guard(uring_latch_);
+    return uring_.Ready();
+}
+
+bool DiskManager::RegisterBuffers(const std::vector<struct iovec> &bufs)
+{
+    std::lock_guard<std::mutex> guard(uring_latch_);
+    if (!uring_.Ready() || !registered_.empty() || !uring_.RegisterBuffers(bufs.data(), bufs.size()))
+    {
+        return false;
+    }
+    registered_ = bufs;
+    return true;
+}
+
+void DiskManager::UnregisterBuffers()
+{
+    std::unique_lock<std::mutex> guard(uring_latch_);
+    if (registered_.empty())
+    {
+        return;
+    }
+    // in-flight fixed I/O still uses the pinned pages
+    while (inflight_ > 0 && SubmitLocked(guard))
+    {
+        ReapLocked(&completed_);
+        WaitLocked(guard, inflight_);
+    }
+    if (uring_.Ready())
+    {
+        uring_.UnregisterBuffers();
+    }
+    registered_.clear();
+}
+
+int DiskManager::RegisteredIndex(const char *buf) const
+{
+    for (size_t i = 0; i < registered_.size(); i++)
+    {
+        const char *base = (const char *)registered_[i].iov_base;
+        if (buf >= base && buf + PAGE_SIZE <= base + registered_[i].iov_len)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void DiskManager::ReadPageAsync(uint32_t page_id, char *page_data, IOCallback cb)
+{
+    QueueIO(IoUring::kRead, page_id, page_data, std::move(cb));
+}
+
+void DiskManager::WritePageAsync(uint32_t page_id, const char *page_data, IOCallback cb)
+{
+    num_writes_ += 1;
+    QueueIO(IoUring::kWrite, page_id, (char *)page_data, std::move(cb));
+}
+
+void DiskManager::QueueIO(IoUring::Op op, uint32_t page_id, char *buf, IOCallback cb)
+{
+    off_t offset = (off_t)page_id * PAGE_SIZE;
+    std::unique_lock<std::mutex> guard(uring_latch_);
+    if (direct_io_ && !Aligned(buf, 0, 0))
+    {
+        // the buffer is the caller's until the callback, no bounce possible
+        completed_.emplace_back(std::move(cb), -EINVAL);
+        return;
+    }
+    if (!uring_.Ready())
+    {
+        // fallback: do it now, report it from PollIO like a completion
+        guard.unlock();
+        int res;
+        if (op == IoUring::kRead)
+        {
+            res = PreadAll(db_fd_, buf, PAGE_SIZE, offset);
+            if (res < 0)
+            {
+                res = -errno;
+            }
+            else if (res < PAGE_SIZE)
+            {
+                memset(buf + res, 0, PAGE_SIZE - res);
+            }
+        }
+        else
+        {
+            res = PwriteAll(db_fd_, buf, PAGE_SIZE, offset) ? PAGE_SIZE : -errno;
+        }
+        guard.lock();
+        completed_.emplace_back(std::move(cb), res);
+        return;
+    }
+    // depth reached, make room
+    while (uring_.Ready() && free_slots_.empty())
+    {
+        if (SubmitLocked(guard))
+        {
+            ReapLocked(&completed_);
+            WaitLocked(guard, free_slots_.empty() ? 1 : 0);
+        }
+    }
+    if (!uring_.Ready())
+    {
+        // the ring was dropped meanwhile, go inline
+        guard.unlock();
+        QueueIO(op, page_id, buf, std::move(cb));
+        return;
+    }
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[slot] = AsyncIO{std::move(cb), buf, op == IoUring::kRead};
+    inflight_++;
+    while (!uring_.Prep(op, db_fd_, buf, PAGE_SIZE, offset, slot, RegisteredIndex(buf)))
+    {
+        // submission queue full; a reset reports this slot as failed
+        if (!SubmitLocked(guard))
         {
             return;
         }
     }
 }
 
+void DiskManager::ReapLocked(std::vector<std::pair<IOCallback, int>> *done)
+{
+    if (waiting_)
+    {
+        // the waiter counts on the completions it waits for
+        return;
+    }
+    uint64_t slot;
+    int res;
+    while (uring_.Peek(&slot, &res))
+    {
+        AsyncIO &io = slots_[slot];
+        if (io.read && res >= 0 && res < PAGE_SIZE)
+        {
+            memset(io.buf + res, 0, PAGE_SIZE - res);
+        }
+        done->emplace_back(std::move(io.cb), res);
+        io.cb = nullptr;
+        free_slots_.push_back(slot);
+        inflight_--;
+    }
+}
+
+void DiskManager::SubmitIO()
+{
+    std::unique_lock<std::mutex> guard(uring_latch_);
+    if (uring_.Ready())
+    {
+        SubmitLocked(guard);
+    }
+}
+
+int DiskManager::PollIO(unsigned min_complete)
+{
+    std::vector<std::pair<IOCallback, int>> done;
+    {
+        std::unique_lock<std::mutex> guard(uring_latch_);
+        if (uring_.Ready() && SubmitLocked(guard))
+        {
+            ReapLocked(&completed_);
+            // blocks without uring_latch_, other threads keep queueing
+            if (completed_.size() < min_complete)
+            {
+                WaitLocked(guard, min_complete - completed_.size());
+            }
+        }
+        done.swap(completed_);
+    }
+    for (auto &d : done)
+    {
+        if (d.first)
+        {
+            d.first(d.second);
+        }
+    }
+    return done.size();
+}
+
+size_t DiskManager::PendingIO()
+{
+    std::lock_guard<std::mutex> guard(uring_latch_);
+    return inflight_ + completed_.size();
+}
+
+void DiskManager::Read(char *buf, int offset, size_t size)
+{
+    if (direct_io_ && !Aligned(buf, offset, size))
+    {
+        std::cerr << "Read fail, O_DIRECT needs " << kDirectIOAlign << "B aligned buffer, offset and size" << std::endl;
+        return;
+    }
+    if (PreadAll(db_fd_, buf, size, offset) < 0)
+    {
+        std::cerr << "Read failed" << std::endl;
+    }
+}
+
 void DiskManager::WriteLog(char *log_data, int size)
 {
     // enforce swap log buffer
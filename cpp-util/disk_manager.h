@@ -1,15 +1,51 @@
 #pragma once
 extern "C" {
 #include <sys/stat.h>
+#include <unistd.h>
 }
 #include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <future>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+#include "io_uring.h"
 #include "page.h"
 
+class Bitmap;
+
+// O_DIRECT buffer, offset and length alignment
+constexpr size_t kDirectIOAlign = 4096;
+
 /**
  * 负责以page粒度读写磁盘。
+ * Pages go through pread/pwrite on one fd with no shared file position, so
+ * any number of threads may read and write pages in parallel. Writes reach
+ * the page cache of the OS only, call Sync() for durability.
+ *
+ * Async mode (EnableAsyncIO) queues ReadPageAsync/WritePageAsync on an
+ * io_uring and submits them in batches; PollIO reaps completions and runs
+ * their callbacks. Without io_uring the async calls do the I/O inline and
+ * still report through PollIO, so callers need a single code path. A
+ * failed submit fails every I/O in the ring with its error, then the ring
+ * is recreated without SQPOLL, or the calls go inline.
+ *
+ * With direct_io the file is opened O_DIRECT and bypasses the OS page
+ * cache, so memory goes to PageCache instead of being cached twice. Page
+ * buffers should be kDirectIOAlign aligned (PageCache frames and Page are);
+ * ReadPage/WritePage bounce unaligned ones, async calls reject them with
+ * -EINVAL, and Read/Append refuse unaligned buffer, offset or size.
+ *
+ * By default AllocatePage only hands out increasing ids. EnableFreeSpaceMap
+ * keeps a bitmap of used pages, cached in memory and stored in the first
+ * pages of the file, so DeallocatePage returns a page for reuse and Trim
+ * cuts free pages off the end of the file. The map reaches the file only
+ * on Sync(), ShutDown() and destruction: after a crash, pages allocated
+ * since the last Sync() read as free and may be handed out again, so Sync()
+ * before a new page is referenced from anything durable.
  */
 class DiskManager
 {
@@ -17,15 +53,80 @@ public:
     /**
      * Creates a new disk manager that writes to the specified database file.
      * @param db_file the file name of the database file to write to
+     * @param direct_io open with O_DIRECT, ignored where the filesystem
+     * has no direct I/O, see DirectIO()
      */
-    explicit DiskManager(const std::string &db_file);
-    ~DiskManager() = default;
+    explicit DiskManager(const std::string &db_file, bool direct_io = false);
+    ~DiskManager();
     void ShutDown() {
-        db_io_.close();
+        if (db_fd_ >= 0) {
+            FlushFreeSpaceMap();
+            close(db_fd_);
+            db_fd_ = -1;
+        }
         log_io_.close();
     }
-    void WritePage(uint32_t page_id, const char *page_data);
+    /** @return false if the write failed */
+    bool WritePage(uint32_t page_id, const char *page_data);
+    /**
+     * Write n pages with consecutive ids starting at first_page_id in one
+     * pwritev, n <= IOV_MAX.
+     * @return false if the write failed, a prefix may have been written
+     */
+    bool WritePages(uint32_t first_page_id, char *const *pages, size_t n);
+    /**
+     * Read a page, the part beyond the end of the file reads as zeros.
+     */
     void ReadPage(uint32_t page_id, char *page_data);
+    /**
+     * Make every page written so far durable (fdatasync), writing the
+     * free-space map first.
+     * @return false if the sync failed
+     */
+    bool Sync();
+
+    /** res: bytes transferred or -errno */
+    using IOCallback = std::function<void(int res)>;
+    /**
+     * Switch on the io_uring engine.
+     * @param depth I/Os in flight at most
+     * @param sqpoll let a kernel thread poll the submission queue; where
+     *        the kernel refuses it (before 5.11) the ring is set up without
+     * @return false if io_uring or its read/write ops (5.6+) are
+     *         unavailable, async calls then run inline
+     */
+    bool EnableAsyncIO(unsigned depth = 64, bool sqpoll = false);
+    /** false if io_uring is off, or was dropped after a failed submit */
+    bool AsyncIOEnabled();
+    /**
+     * Register page frame memory (e.g. PageCache's regions) with the ring,
+     * async I/O on pages inside them skips the per-I/O page pinning.
+     */
+    bool RegisterBuffers(const std::vector<struct iovec> &bufs);
+    /**
+     * Undo RegisterBuffers, waiting for the I/Os in flight first. Call it
+     * before the registered memory is unmapped.
+     */
+    void UnregisterBuffers();
+    /**
+     * Queue a page read, the part beyond the end of the file reads as
+     * zeros. cb runs from PollIO once the page is in page_data.
+     */
+    void ReadPageAsync(uint32_t page_id, char *page_data, IOCallback cb);
+    /** page_data must stay unchanged until cb runs */
+    void WritePageAsync(uint32_t page_id, const char *page_data, IOCallback cb);
+    /** Submit the queued I/Os without waiting. */
+    void SubmitIO();
+    /**
+     * Submit, wait until at least min_complete I/Os finished (fewer if
+     * fewer are in flight) and run the callbacks of every finished one.
+     * The wait does not hold the ring latch, so other threads keep queueing
+     * meanwhile; a concurrent PollIO may run the callbacks instead.
+     * @return the number of callbacks run
+     */
+    int PollIO(unsigned min_complete = 0);
+    /** I/Os queued or in flight whose callbacks have not run yet */
+    size_t PendingIO();
     void Append(const char *buf, size_t size);
     void Read(char *buf, int off, size_t size);
 
@@ -46,10 +147,30 @@ public:
     bool ReadLog(char *log_data, int size, int offset);
 
     /**
-     * Allocate a page on disk.
-     * @return the id of the allocated page
+     * Track free pages of a file of at most max_pages pages. The map is
+     * loaded from an existing file, or created in a new one, and occupies
+     * pages [0, ReservedPages()). Call it before any page I/O.
+     * @return false if the file is not empty and has no map of max_pages
      */
-    uint32_t AllocatePage() { return next_page_id_++; }
+    bool EnableFreeSpaceMap(uint32_t max_pages);
+    bool FreeSpaceMapEnabled() const { return fsm_ != nullptr; }
+    /** pages at the start of the file holding the free-space map */
+    uint32_t ReservedPages() const { return fsm_pages_; }
+
+    /**
+     * Allocate a page on disk, the lowest free one with a free-space map.
+     * The map page is marked dirty, the next Sync() persists it.
+     * @return the id of the allocated page, INVALID_PAGE_ID if the map is full
+     */
+    uint32_t AllocatePage();
+    /** Return a page for reuse, a no-op without a free-space map */
+    void DeallocatePage(uint32_t page_id);
+    /**
+     * Truncate the free pages at the end of the file, along with anything
+     * appended past the last used page.
+     * @return the number of pages cut off
+     */
+    uint32_t Trim();
     uint32_t MaxPageId() { return next_page_id_ - 1; }
     uint32_t NextPageId() { return next_page_id_; }
     void SetNextPageId(uint32_t id) { next_page_id_ = id; }
@@ -60,6 +181,9 @@ public:
 
     int GetNumWrites() { return num_writes_; }
 
+    /** whether the file is really open with O_DIRECT */
+    bool DirectIO() const { return direct_io_; }
+
     /**
      * Sets the future which is used to check for non-blocking flushes.
      * @param f the non-blocking flush check
@@ -78,11 +202,54 @@ public:
 private:
     std::fstream log_io_;
     std::string log_name_;
-    std::fstream db_io_;
     std::string file_name_;
+    int db_fd_ = -1;
+    bool direct_io_ = false;
+
+    // write the changed pages of the free-space map
+    void FlushFreeSpaceMap();
+    Bitmap *fsm_ = nullptr;        // bit set: page in use
+    uint32_t fsm_pages_ = 0;       // pages holding the map
+    uint32_t fsm_hint_ = 0;        // the words below have no free bit
+    std::vector<bool> fsm_dirty_;  // map pages changed since the last flush
+    // protects: fsm_ contents, fsm_hint_, fsm_dirty_
+    std::mutex fsm_latch_;
+    // Append finds the end of the file, then writes there
+    std::mutex append_latch_;
+
+    struct AsyncIO {
+        IOCallback cb;
+        char *buf;   // read target, zero-filled past the end of the file
+        bool read;
+    };
+    void QueueIO(IoUring::Op op, uint32_t page_id, char *buf, IOCallback cb);
+    void ReapLocked(std::vector<std::pair<IOCallback, int>> *done);
+    bool ProbeRingLocked();
+    // Submit, false if it failed and the ring was reset
+    bool SubmitLocked(std::unique_lock<std::mutex> &guard);
+    // wait for up to wait_nr submitted I/Os with uring_latch_ released and
+    // reap them. One thread waits in the kernel, the others for it
+    void WaitLocked(std::unique_lock<std::mutex> &guard, size_t wait_nr);
+    // fail every I/O in the ring with err, then recreate it without SQPOLL
+    // or fall back to inline I/O
+    void ResetRingLocked(int err);
+    int RegisteredIndex(const char *buf) const;
+    IoUring uring_;
+    std::vector<AsyncIO> slots_;         // indexed by user_data
+    std::vector<uint32_t> free_slots_;
+    std::vector<struct iovec> registered_;
+    // finished, callbacks not run yet
+    std::vector<std::pair<IOCallback, int>> completed_;
+    size_t inflight_ = 0;
+    bool waiting_ = false; // a thread is in WaitLocked, only it reaps
+    std::condition_variable reaped_cv_; // the waiter came back
+    uint64_t ring_resets_ = 0;
+    // protects: uring_ (but Wait), slots_, free_slots_, completed_,
+    // inflight_, waiting_, ring_resets_
+    std::mutex uring_latch_;
     std::atomic<uint32_t> next_page_id_;
     int num_flushes_;
-    int num_writes_;
+    std::atomic<int> num_writes_;
     bool flush_log_;
     std::future<void> *flush_log_f_;
 };
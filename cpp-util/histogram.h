@@ -17,15 +17,15 @@ class Histogram {
   void Merge(const Histogram& other);
 
   std::string ToString() const;
-
- private:
-  enum { kNumBuckets = 154 };
-
+  double Count() const { return num_; }
   double Median() const;
   double Percentile(double p) const;
   double Average() const;
   double StandardDeviation() const;
 
+ private:
+  enum { kNumBuckets = 154 };
+
   static const double kBucketLimit[kNumBuckets];
 
   double min_;
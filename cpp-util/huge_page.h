@@ -0,0 +1,181 @@
+/**
+ * anonymous memory region backed by 2MB huge pages when the host allows it
+ * tries MAP_HUGETLB (reserved hugetlbfs pages) first, then a normal mapping
+ * with madvise(MADV_HUGEPAGE) for transparent huge pages, which the kernel
+ * may or may not honour. Optionally bound to one NUMA node with mbind,
+ * called through syscall so there is no libnuma dependency.
+ */
+#pragma once
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+class HugePageRegion
+{
+public:
+  static const size_t kHugePageSize = 2 << 20;
+
+  enum Backing
+  {
+    kNone,    // not allocated
+    kHugeTLB, // MAP_HUGETLB
+    kTHP,     // madvise(MADV_HUGEPAGE), best effort
+    kNormal,  // THP unavailable
+  };
+
+  HugePageRegion() = default;
+  ~HugePageRegion() { Free(); }
+
+  HugePageRegion(const HugePageRegion &) = delete;
+  HugePageRegion &operator=(const HugePageRegion &) = delete;
+
+  // bytes are rounded up to the huge page size, memory is zeroed.
+  // node: NUMA node to bind to, -1 for the default policy
+  // return nullptr if even a normal mapping fails
+  char *Allocate(size_t bytes, int node = -1)
+  {
+    Free();
+    size_ = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+    {
+      backing_ = kHugeTLB;
+    }
+    else
+    {
+      p = MapAligned(size_);
+      if (p == nullptr)
+      {
+        size_ = 0;
+        return nullptr;
+      }
+      backing_ = madvise(p, size_, MADV_HUGEPAGE) == 0 ? kTHP : kNormal;
+    }
+    base_ = (char *)p;
+    if (node >= 0)
+    {
+      BindNode(base_, size_, node);
+    }
+    return base_;
+  }
+
+  void Free()
+  {
+    if (base_ != nullptr)
+    {
+      munmap(base_, size_);
+      base_ = nullptr;
+      size_ = 0;
+      backing_ = kNone;
+    }
+  }
+
+  char *data() const { return base_; }
+  size_t size() const { return size_; }
+  Backing backing() const { return backing_; }
+
+  // ids of the online NUMA nodes, which need not be 0..n-1; {0} on hosts
+  // without NUMA
+  static std::vector<int> NumaNodes()
+  {
+    char list[256] = {0};
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if (f != nullptr)
+    {
+      if (fgets(list, sizeof(list), f) == nullptr)
+      {
+        list[0] = '\0';
+      }
+      fclose(f);
+    }
+    std::vector<int> nodes = ParseNodeList(list);
+    if (nodes.empty())
+    {
+      nodes.push_back(0);
+    }
+    return nodes;
+  }
+
+  // kernel cpu/node list format, e.g. "0-1,4,6-7"
+  static std::vector<int> ParseNodeList(const char *list)
+  {
+    std::vector<int> nodes;
+    const char *p = list;
+    while (*p >= '0' && *p <= '9')
+    {
+      char *end;
+      long lo = strtol(p, &end, 10);
+      long hi = lo;
+      if (*end == '-')
+      {
+        hi = strtol(end + 1, &end, 10);
+      }
+      for (long n = lo; n <= hi; n++)
+      {
+        nodes.push_back((int)n);
+      }
+      p = *end == ',' ? end + 1 : end;
+    }
+    return nodes;
+  }
+
+  // node of the cpu the caller runs on, 0 if unknown
+  static int CurrentNode()
+  {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    {
+      return 0;
+    }
+    return (int)node;
+  }
+
+private:
+  // THP only backs 2MB aligned ranges, over-map and trim
+  static void *MapAligned(size_t size)
+  {
+    size_t len = size + kHugePageSize;
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+      return nullptr;
+    }
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t aligned = (start + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1);
+    if (aligned > start)
+    {
+      munmap(p, aligned - start);
+    }
+    size_t tail = start + len - (aligned + size);
+    if (tail > 0)
+    {
+      munmap((void *)(aligned + size), tail);
+    }
+    return (void *)aligned;
+  }
+
+  // MPOL_PREFERRED: fall back to other nodes instead of failing allocations
+  static void BindNode(void *addr, size_t len, int node)
+  {
+    const int kMpolPreferred = 1;
+    unsigned long mask[16] = {0};
+    if (node >= (int)(sizeof(mask) * 8))
+    {
+      return;
+    }
+    mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+    // a failure (no NUMA support) leaves the default policy
+    syscall(SYS_mbind, addr, len, kMpolPreferred, mask, sizeof(mask) * 8, 0);
+  }
+
+  char *base_ = nullptr;
+  size_t size_ = 0;
+  Backing backing_ = kNone;
+};
@@ -0,0 +1,280 @@
+/**
+ * minimal io_uring ring over the raw syscalls, no liburing needed
+ * (see example/io_uring/io_uring_cat.c for the walkthrough).
+ * No thread safety, guard it with the owner's lock.
+ * HAVE_IO_URING is 0 where the kernel headers lack io_uring, then Init
+ * always fails and the owner falls back to synchronous I/O.
+ */
+#pragma once
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#ifndef HAVE_IO_URING
+#define HAVE_IO_URING 0
+#endif
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class IoUring
+{
+public:
+  enum Op
+  {
+    kRead,
+    kWrite,
+  };
+
+  IoUring() = default;
+  ~IoUring() { Close(); }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+#if HAVE_IO_URING
+  // entries: submission queue depth. sqpoll: a kernel thread polls the
+  // queue, so submitting needs no syscall while it is awake (idle_ms)
+  bool Init(unsigned entries, bool sqpoll = false, unsigned idle_ms = 1000)
+  {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll)
+    {
+      p.flags |= IORING_SETUP_SQPOLL;
+      p.sq_thread_idle = idle_ms;
+    }
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring_fd_ < 0)
+    {
+      return false;
+    }
+    sqpoll_ = sqpoll;
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // since 5.4 both rings share one mapping
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_len_ > sq_len_)
+    {
+      sq_len_ = cq_len_;
+    }
+    sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    cq_ptr_ = single ? sq_ptr_
+                     : mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring_fd_, IORING_OFF_CQ_RING);
+    sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe *)mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+      Close();
+      return false;
+    }
+    char *sq = (char *)sq_ptr_;
+    sq_head_ = (unsigned *)(sq + p.sq_off.head);
+    sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask_ = *(unsigned *)(sq + p.sq_off.ring_mask);
+    sq_flags_ = (unsigned *)(sq + p.sq_off.flags);
+    sq_array_ = (unsigned *)(sq + p.sq_off.array);
+    sq_entries_ = p.sq_entries;
+    char *cq = (char *)cq_ptr_;
+    cq_head_ = (unsigned *)(cq + p.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask_ = *(unsigned *)(cq + p.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    cq_entries_ = p.cq_entries;
+    tail_ = *sq_tail_;
+    return true;
+  }
+
+  void Close()
+  {
+    if (ring_fd_ < 0)
+    {
+      return;
+    }
+    if (sqes_ != nullptr && sqes_ != MAP_FAILED)
+    {
+      munmap(sqes_, sqes_len_);
+    }
+    if (cq_ptr_ != nullptr && cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+    {
+      munmap(cq_ptr_, cq_len_);
+    }
+    if (sq_ptr_ != nullptr && sq_ptr_ != MAP_FAILED)
+    {
+      munmap(sq_ptr_, sq_len_);
+    }
+    close(ring_fd_);
+    ring_fd_ = -1;
+    sq_ptr_ = cq_ptr_ = nullptr;
+    sqes_ = nullptr;
+  }
+
+  // pin buffers for kRead/kWrite with buf_index, saves the per-I/O page
+  // mapping of the kernel. Only one registration per ring
+  bool RegisterBuffers(const struct iovec *iov, unsigned n)
+  {
+    return syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iov, n) == 0;
+  }
+
+  // drop the registration, before the registered memory goes away
+  bool UnregisterBuffers()
+  {
+    return syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0;
+  }
+
+  // queue one read or write, false if the submission queue is full.
+  // buf_index: registered buffer holding buf, -1 for none
+  bool Prep(Op op, int fd, void *buf, unsigned len, uint64_t off, uint64_t user_data, int buf_index = -1)
+  {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (tail_ - head >= sq_entries_)
+    {
+      return false;
+    }
+    unsigned index = tail_ & sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (buf_index >= 0)
+    {
+      sqe->opcode = op == kRead ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = buf_index;
+    }
+    else
+    {
+      sqe->opcode = op == kRead ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    tail_++;
+    // the SQPOLL thread may pick it up right away
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    unsubmitted_++;
+    return true;
+  }
+
+  // hand the queued entries to the kernel and wait for wait_nr completions.
+  // return the number submitted, or -errno
+  int Submit(unsigned wait_nr = 0)
+  {
+    unsigned to_submit = unsubmitted_;
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (sqpoll_)
+    {
+      // the kernel thread submits, only wake it if it went idle
+      to_submit = 0;
+      if (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+      {
+        flags |= IORING_ENTER_SQ_WAKEUP;
+      }
+      if (flags == 0)
+      {
+        unsubmitted_ = 0;
+        return 0;
+      }
+    }
+    else if (to_submit == 0 && wait_nr == 0)
+    {
+      return 0;
+    }
+    int ret;
+    do
+    {
+      ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+    {
+      return -errno;
+    }
+    unsubmitted_ = sqpoll_ ? 0 : unsubmitted_ - ret;
+    return ret;
+  }
+
+  // wait for wait_nr completions without submitting. It reads no ring
+  // state besides the fd, so it may run while another thread submits
+  int Wait(unsigned wait_nr)
+  {
+    int ret;
+    do
+    {
+      ret = syscall(__NR_io_uring_enter, ring_fd_, 0, wait_nr, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+  }
+
+  // pop one completion, false if there is none
+  bool Peek(uint64_t *user_data, int *res)
+  {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+    struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  unsigned Depth() const { return sq_entries_; }
+  bool SqPoll() const { return sqpoll_; }
+  // queued entries the kernel has not been handed yet
+  unsigned Unsubmitted() const { return unsubmitted_; }
+#else
+  bool Init(unsigned, bool = false, unsigned = 1000) { return false; }
+  void Close() {}
+  bool RegisterBuffers(const struct iovec *, unsigned) { return false; }
+  bool UnregisterBuffers() { return false; }
+  bool Prep(Op, int, void *, unsigned, uint64_t, uint64_t, int = -1) { return false; }
+  int Submit(unsigned = 0) { return -ENOSYS; }
+  int Wait(unsigned) { return -ENOSYS; }
+  bool Peek(uint64_t *, int *) { return false; }
+  unsigned Depth() const { return 0; }
+  bool SqPoll() const { return false; }
+  unsigned Unsubmitted() const { return 0; }
+#endif
+
+  bool Ready() const { return ring_fd_ >= 0; }
+
+private:
+  int ring_fd_ = -1;
+#if HAVE_IO_URING
+  bool sqpoll_ = false;
+  void *sq_ptr_ = nullptr;
+  void *cq_ptr_ = nullptr;
+  size_t sq_len_ = 0;
+  size_t cq_len_ = 0;
+  size_t sqes_len_ = 0;
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_flags_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  unsigned cq_entries_ = 0;
+  struct io_uring_cqe *cqes_ = nullptr;
+  unsigned tail_ = 0;        // local sq tail
+  unsigned unsubmitted_ = 0; // queued since the last Submit
+#endif
+};
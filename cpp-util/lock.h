@@ -1,5 +1,7 @@
 #pragma once
 #include <atomic>
+#include <cassert>
+#include <functional>
 #include <thread>
 #include <cstdlib>
 #include <climits>
@@ -62,6 +64,9 @@ class RWMutex {
   void WriteLock() {
     pthread_rwlock_wrlock(&mu_);
   }
+  bool TryWriteLock() {
+    return pthread_rwlock_trywrlock(&mu_) == 0;
+  }
   void ReadUnlock() {
     pthread_rwlock_unlock(&mu_);
   }
@@ -251,6 +256,12 @@ class Striped {
     return &reinterpret_cast<LockData<T> *>(&locks_[index])->lock_;
   }
 
+  // the stripe at index, used to walk every stripe, e.g. for a global op
+  T *at(size_t index) {
+    assert(index < stripes_);
+    return &locks_[index].lock_;
+  }
+
  private:
   size_t stripes_;
   LockData<T> *locks_;
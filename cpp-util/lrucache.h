@@ -3,14 +3,33 @@
  * learn from leveldb
 */
 #pragma once
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <mutex>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "arena.h"
+#include "coding.h"
+#include "histogram.h"
 #include "slice.h"
 #include "murmur2.h"
+#include "lock.h"
+#include "tinylfu.h"
+#include "timer_wheel.h"
 using namespace std;
 
 // "in_cache" boolean indicating whether the cache has a reference on the entry. 
@@ -22,16 +41,25 @@ using namespace std;
 // think one client is reading, but other client delete it, we cannot delete it immediately
 // because the former might cannot read value, so we make it in_cache == false and ref==1
 // when the former release it, we can safely delete it
+//
+// next_hash/refs/referenced are accessed with __atomic builtins so that the
+// lock-free lookup mode (see LRUCache::SetLockFreeLookup) can read them
+// without holding the shard mutex.
 struct LRUEntry
 {
   void *value;
   LRUEntry *next_hash; //链表法解决哈希冲突
   LRUEntry *next;
   LRUEntry *prev;
+  size_t charge;     // counted against the shard capacity, e.g. bytes
   size_t key_length;
   uint32_t refs;
   uint32_t hash;     // Hash of key(); used for fast sharding and comparisons
   bool in_cache;     // Whether entry is in the cache.
+  bool referenced;   // CLOCK bit, set by lock-free lookups; hit bit otherwise
+  bool high_pri;     // inserted with kHighPriority
+  bool in_high_pool; // on the hot segment of lru_
+  TimerNode timer;   // timer.expire: ms of LRUCache::NowMs(), 0 never expires
   char key_data[1];  // Beginning of key K
 
   Slice key() const
@@ -41,16 +69,50 @@ struct LRUEntry
   }
 };
 
+// Writers are serialized by the owner's mutex. Readers may use
+// LookupConcurrent() without the mutex: bucket heads and next_hash are
+// published with release stores, and replaced bucket arrays are kept,
+// tagged with the owner's epoch (SetEpoch), until the owner calls
+// FreeRetired() with an epoch no reader can still be in.
+//
+// Growing is incremental: Resize() only installs a table twice as large,
+// every Insert/Remove then moves kMigrateBuckets buckets of the old table.
+// An old bucket below migrate_pos_ has been moved, so a key lives in
+// exactly one of the two tables.
 class HashTable
 {
 public:
-  HashTable() : length_(0), elems_(0), list_(nullptr) { Resize(); }
-  ~HashTable() { delete[] list_; }
+  HashTable() : buckets_(nullptr), old_(nullptr), migrate_pos_(0), elems_(0) { Resize(); }
+  ~HashTable()
+  {
+    FreeRetired(UINT64_MAX);
+    FreeBuckets(old_);
+    FreeBuckets(buckets_);
+  }
 
   LRUEntry *Lookup(const Slice &key, uint32_t hash)
   {
     return *FindPointer(key, hash);
   }
+  // may be called concurrently with one writer, might miss an entry
+  // which is being migrated to the new table
+  LRUEntry *LookupConcurrent(const Slice &key, uint32_t hash) const
+  {
+    // buckets_ is published after old_, so a reader seeing the new table
+    // also sees the table still being migrated
+    const Buckets *b = __atomic_load_n(&buckets_, __ATOMIC_ACQUIRE);
+    const Buckets *old = __atomic_load_n(&old_, __ATOMIC_ACQUIRE);
+    LRUEntry *e = nullptr;
+    if (old != nullptr)
+    {
+      e = FindConcurrent(old, key, hash);
+    }
+    if (e == nullptr)
+    {
+      e = FindConcurrent(b, key, hash);
+    }
+    return e;
+  }
   //返回旧值，如果为null，则旧值不存在
   LRUEntry *Insert(LRUEntry *h)
   {
@@ -59,15 +121,16 @@ public:
     //如果old == null，说明是新添加的key
     //如果old不为null，则把old的next_hash付给h的next_hash
     h->next_hash = (old == nullptr ? nullptr : old->next_hash);
-    *ptr = h;
+    __atomic_store_n(ptr, h, __ATOMIC_RELEASE);
     if (old == nullptr)
     {
       ++elems_;
-      if (elems_ > length_)
+      if (elems_ > buckets_->length)
       {
         Resize();
       }
     }
+    MigrateSome();
     return old;
   }
 
@@ -77,22 +140,110 @@ public:
     LRUEntry *result = *ptr;
     if (result != nullptr)
     {
-      *ptr = result->next_hash;
+      __atomic_store_n(ptr, result->next_hash, __ATOMIC_RELEASE);
       --elems_;
     }
+    MigrateSome();
     return result;
   }
 
-  size_t Size() { return elems_; }
+  size_t Size() const { return elems_; }
+  bool Rehashing() const { return old_ != nullptr; }
+
+  // Batched probes: PrefetchBucket() for every key first, then
+  // PrefetchHead(), so the DRAM misses of a batch overlap. Safe for
+  // lock-free readers, while rehashing both tables are touched.
+  void PrefetchBucket(uint32_t hash) const
+  {
+    const Buckets *b = __atomic_load_n(&buckets_, __ATOMIC_ACQUIRE);
+    const Buckets *old = __atomic_load_n(&old_, __ATOMIC_ACQUIRE);
+    __builtin_prefetch(&b->list[hash & (b->length - 1)]);
+    if (old != nullptr)
+    {
+      __builtin_prefetch(&old->list[hash & (old->length - 1)]);
+    }
+  }
+  void PrefetchHead(uint32_t hash) const
+  {
+    const Buckets *b = __atomic_load_n(&buckets_, __ATOMIC_ACQUIRE);
+    const Buckets *old = __atomic_load_n(&old_, __ATOMIC_ACQUIRE);
+    PrefetchEntry(b, hash);
+    if (old != nullptr)
+    {
+      PrefetchEntry(old, hash);
+    }
+  }
+
+  // keep replaced bucket arrays alive for concurrent readers
+  void SetDeferFree(bool defer) { defer_free_ = defer; }
+  // arrays replaced from now on are retired in epoch
+  void SetEpoch(uint64_t epoch) { epoch_ = epoch; }
+  bool HasRetired() const { return !retired_.empty(); }
+  // free the arrays retired before epoch
+  void FreeRetired(uint64_t epoch)
+  {
+    size_t n = 0;
+    while (n < retired_.size() && retired_[n].first < epoch)
+    {
+      FreeBuckets(retired_[n++].second);
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + n);
+  }
 
 private:
-  uint32_t length_; // capacity
-  uint32_t elems_;  // size
-  LRUEntry **list_; // hashtable
+  static const uint32_t kMigrateBuckets = 4;
+
+  struct Buckets
+  {
+    uint32_t length; // capacity
+    LRUEntry **list;
+  };
+
+  Buckets *buckets_;     // hashtable
+  Buckets *old_;         // table being migrated into buckets_, or nullptr
+  uint32_t migrate_pos_; // old_ buckets below it have been migrated
+  uint32_t elems_;       // size
+  bool defer_free_ = false;
+  uint64_t epoch_ = 0;
+  std::vector<std::pair<uint64_t, Buckets *>> retired_; // in epoch order
+
+  static void FreeBuckets(Buckets *b)
+  {
+    if (b != nullptr)
+    {
+      delete[] b->list;
+      delete b;
+    }
+  }
+
+  static LRUEntry *FindConcurrent(const Buckets *b, const Slice &key, uint32_t hash)
+  {
+    LRUEntry *e = __atomic_load_n(&b->list[hash & (b->length - 1)], __ATOMIC_ACQUIRE);
+    // not e->key(), its assert reads the list pointers owned by the writer
+    while (e != nullptr && (e->hash != hash || key != Slice(e->key_data, e->key_length)))
+    {
+      e = __atomic_load_n(&e->next_hash, __ATOMIC_ACQUIRE);
+    }
+    return e;
+  }
+
+  static void PrefetchEntry(const Buckets *b, uint32_t hash)
+  {
+    LRUEntry *e = __atomic_load_n(&b->list[hash & (b->length - 1)], __ATOMIC_ACQUIRE);
+    if (e != nullptr)
+    {
+      __builtin_prefetch(e);
+    }
+  }
 
   LRUEntry **FindPointer(const Slice &key, uint32_t hash)
   {
-    LRUEntry **ptr = &list_[hash & (length_ - 1)];
+    Buckets *b = buckets_;
+    if (old_ != nullptr && (hash & (old_->length - 1)) >= migrate_pos_)
+    {
+      b = old_;
+    }
+    LRUEntry **ptr = &b->list[hash & (b->length - 1)];
     while (*ptr != nullptr && ((*ptr)->hash != hash || key != (*ptr)->key()))
     {
       ptr = &(*ptr)->next_hash;
@@ -102,93 +253,382 @@ private:
 
   void Resize()
   {
+    // the previous migration normally finishes long before the table fills
+    // up again, only a caller that never migrates ends up here
+    while (old_ != nullptr)
+    {
+      MigrateSome();
+    }
     uint32_t new_length = 4;
     // new_length为首个大于elem的2的整数次幂
     while (new_length < elems_)
     {
       new_length <<= 1;
     }
-    LRUEntry **new_list = new LRUEntry *[new_length];
-    memset(new_list, 0, sizeof(LRUEntry *) * new_length);
-    uint32_t count = 0;
-    //一次迁移完
-    for (uint32_t i = 0; i < length_; i++)
+    Buckets *nb = new Buckets;
+    nb->length = new_length;
+    nb->list = new LRUEntry *[new_length];
+    memset(nb->list, 0, sizeof(LRUEntry *) * new_length);
+    if (buckets_ == nullptr)
     {
-      LRUEntry *h = list_[i];
+      buckets_ = nb;
+      return;
+    }
+    migrate_pos_ = 0;
+    __atomic_store_n(&old_, buckets_, __ATOMIC_RELEASE);
+    __atomic_store_n(&buckets_, nb, __ATOMIC_RELEASE);
+  }
+
+  // 渐进式迁移，每次迁移kMigrateBuckets个bucket
+  void MigrateSome()
+  {
+    if (old_ == nullptr)
+    {
+      return;
+    }
+    const uint32_t new_length = buckets_->length;
+    for (uint32_t n = 0; n < kMigrateBuckets && migrate_pos_ < old_->length; n++, migrate_pos_++)
+    {
+      LRUEntry *h = old_->list[migrate_pos_];
       //迁移这个bucket
       while (h != nullptr)
       {
         LRUEntry *next = h->next_hash;
-        uint32_t hash = h->hash;
-        LRUEntry **ptr = &new_list[hash & (new_length - 1)];
-        h->next_hash = *ptr;
-        *ptr = h;
+        LRUEntry **ptr = &buckets_->list[h->hash & (new_length - 1)];
+        __atomic_store_n(&h->next_hash, *ptr, __ATOMIC_RELEASE);
+        __atomic_store_n(ptr, h, __ATOMIC_RELEASE);
         h = next;
-        count++;
+      }
+      __atomic_store_n(&old_->list[migrate_pos_], nullptr, __ATOMIC_RELEASE);
+    }
+    if (migrate_pos_ == old_->length)
+    {
+      Buckets *done = old_;
+      __atomic_store_n(&old_, nullptr, __ATOMIC_RELEASE);
+      migrate_pos_ = 0;
+      if (defer_free_)
+      {
+        retired_.emplace_back(epoch_, done);
+      }
+      else
+      {
+        FreeBuckets(done);
       }
     }
-    assert(elems_ == count);
-    delete[] list_;
-    list_ = new_list;
-    length_ = new_length;
   }
 };
 
+// Memory of LRUEntry, one instance per shard and only called with the shard
+// mutex held. Free gets back the size that was passed to Allocate.
+class EntryAllocator
+{
+public:
+  virtual ~EntryAllocator() {}
+  virtual void *Allocate(size_t bytes) = 0;
+  virtual void Free(void *ptr, size_t bytes) = 0;
+};
+
+class MallocEntryAllocator : public EntryAllocator
+{
+public:
+  void *Allocate(size_t bytes) override { return malloc(bytes); }
+  void Free(void *ptr, size_t) override { free(ptr); }
+};
+
+// the default, evicted entries are recycled through size-classed free lists
+class SlabEntryAllocator : public EntryAllocator
+{
+public:
+  void *Allocate(size_t bytes) override { return arena_.AllocateSlab(bytes); }
+  void Free(void *ptr, size_t bytes) override { arena_.FreeSlab((char *)ptr, bytes); }
+  size_t MemoryUsage() const { return arena_.MemoryUsage(); }
+
+private:
+  SlabArena arena_;
+};
+
+// A snapshot of cache counters, of one shard or merged over several.
+struct CacheStats
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t inserts = 0;
+  // entries dropped to make room, not counting Erase, replacement or expiry
+  uint64_t evictions = 0;
+  // Erase of an entry that a client still held
+  uint64_t erase_pinned = 0;
+  // sampled shard mutex wait in microseconds, see SetLockWaitSampling
+  Histogram lock_wait;
+
+  CacheStats() { lock_wait.Clear(); }
+  void Merge(const CacheStats &other)
+  {
+    hits += other.hits;
+    misses += other.misses;
+    inserts += other.inserts;
+    evictions += other.evictions;
+    erase_pinned += other.erase_pinned;
+    lock_wait.Merge(other.lock_wait);
+  }
+  double HitRatio() const
+  {
+    return hits + misses == 0 ? 0 : (double)hits / (hits + misses);
+  }
+};
+
+// Called on a miss by LookupOrLoad without any cache lock held. Returns the
+// value to cache (nullptr if the key cannot be loaded) and may set *charge,
+// which starts at 1. Must not throw.
+using LRULoader = function<void *(const Slice &key, size_t *charge)>;
+
+// With a high priority pool (LRUCache::SetHighPriPoolRatio) a released entry
+// goes to the hot end of lru_ only if it was inserted with kHighPriority or
+// has been looked up again; the rest are inserted at the midpoint, so a scan
+// only churns the cold segment.
+enum LRUPriority { kLowPriority, kHighPriority };
+
+// Value codec of the warm-restart snapshot. The encoder appends the bytes of
+// a value to *dst; the decoder rebuilds a value from them, returning nullptr
+// drops the entry.
+using LRUEncoder = function<void(const Slice &key, void *value, std::string *dst)>;
+using LRUDecoder = function<void *(const Slice &key, const Slice &data)>;
+
 class LRUCache
 {
 public:
   LRUCache();
   ~LRUCache();
 
-  inline void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  // capacity is in the same unit as the charge passed to Insert
+  inline void SetCapacity(size_t capacity)
+  {
+    capacity_ = capacity;
+    high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
+  }
+  // Share of the capacity kept for hot entries, 0 (default) is plain LRU.
+  // Only used without lock-free lookups, must be set before the first Insert.
+  inline void SetHighPriPoolRatio(double ratio)
+  {
+    assert(ratio >= 0 && ratio <= 1);
+    high_pri_pool_ratio_ = ratio;
+    high_pri_pool_capacity_ = capacity_ * ratio;
+  }
   inline void SetValDeleter(function<void(const Slice&, void* value)> deleter) { deleter_ = deleter; }
+  // Lookup/Release without the shard mutex, must be set before the first Insert.
+  // Pinned entries stay on lru_ and eviction becomes CLOCK: a lookup sets the
+  // reference bit and the evictor gives such entries a second chance.
+  inline void SetLockFreeLookup(bool on)
+  {
+    lock_free_ = on;
+    table_.SetDeferFree(on);
+  }
+  // TinyLFU admission, must be set before the first Insert. Once the shard
+  // is full a new key is only cached if it has been seen more often than the
+  // eviction victim; otherwise Insert returns a handle that is not cached.
+  // Lookup and Insert each record one access, LookupOrLoad one in all;
+  // stats count admitted inserts only.
+  // entries: expected number of entries in this shard
+  inline void SetAdmission(size_t entries) { admission_.reset(new TinyLFU(entries)); }
+  // resolution of the expiry timer wheel, must be set before the first Insert
+  inline void SetExpireTick(uint64_t tick_ms) { tick_ms_ = tick_ms; }
+  // takes ownership, must be set before the first Insert
+  inline void SetEntryAllocator(EntryAllocator *alloc) { alloc_.reset(alloc); }
+  // time the mutex wait of one in every `every` Lookup/Insert/Release/Erase
+  // calls into the lock_wait histogram, 0 turns it off
+  inline void SetLockWaitSampling(uint32_t every) { lock_sample_every_ = every; }
 
-  LRUEntry *Insert(const Slice &key, uint32_t hash, void *value);
-  LRUEntry *Lookup(const Slice &key, uint32_t hash);
+  // ttl_ms > 0: the entry expires ttl_ms later, lookups miss it from then on
+  // and Expire() (or a later Insert) reclaims it
+  LRUEntry *Insert(const Slice &key, uint32_t hash, void *value, size_t charge = 1, uint64_t ttl_ms = 0,
+                   LRUPriority pri = kLowPriority);
+  // count: false keeps the lookup out of the hit/miss stats, e.g. prefetches
+  LRUEntry *Lookup(const Slice &key, uint32_t hash, bool count = true);
+  // Lookup, and on a miss load the value and insert it. Concurrent misses of
+  // one key are coalesced: one caller runs loader, the others wait for it.
+  LRUEntry *LookupOrLoad(const Slice &key, uint32_t hash, const LRULoader &loader,
+                         LRUPriority pri = kLowPriority, bool count = true);
+  // Batched versions, all keys belong to this shard. The mutex is taken once
+  // and bucket heads are prefetched before probing. charges may be nullptr.
+  void MultiLookup(const Slice *keys, const uint32_t *hashes, size_t n, LRUEntry **handles);
+  void MultiInsert(const Slice *keys, const uint32_t *hashes, void *const *values,
+                   const size_t *charges, size_t n, LRUEntry **handles);
   void Release(LRUEntry *handle); 
   void Erase(const Slice &key, uint32_t hash);
   //将lru_的节点全部删除
   void Prune();
+  // drop every entry which expired before now_ms
+  void Expire(uint64_t now_ms);
+  // Drop the least recently used unpinned entry regardless of capacity.
+  // cold_only: only if it is outside the high priority pool. evictable, if
+  // set, is asked under mutex_ about each candidate's value, oldest first,
+  // and a true answer commits to evicting it. false if there is no such
+  // entry.
+  bool EvictOne(bool cold_only, const function<bool(void *value)> &evictable = nullptr);
+  // Append the live entries to *dst, least recently used first, so inserting
+  // them back in order rebuilds the LRU order. Format: varint32 count, then
+  // per entry key, varint64 charge, varint64 deadline in WallMs() (0 = none)
+  // and the encoded value, key and value length prefixed. The entries are
+  // pinned under mutex_ and encoded after it is released, so encode never
+  // blocks the shard; they may outlive an eviction by that long.
+  void Snapshot(const LRUEncoder &encode, std::string *dst);
+  // ms of a monotonic clock, the time base of entry expiry
+  static uint64_t NowMs()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  // ms since the Unix epoch; snapshot deadlines use it to survive a restart
+  static uint64_t WallMs()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+  }
   size_t TotalElem() const
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    return table_.Size();
+  }
+  size_t TotalCharge() const
   {
     std::lock_guard<std::mutex> l(mutex_);
     return usage_;
   }
+  // lock-free mode: freed entries still waiting for readers to move on
+  size_t RetiredEntries() const
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    return retired_.size();
+  }
+  CacheStats GetStats() const;
 
 private:
+  static const int kReaderSlots = 16;
+  // Reclamation is epoch based. A reader counts itself in active[epoch & 1]
+  // of its slot; epoch_ advances once nobody is left in the other half, and
+  // whatever was retired in epoch e is freed from epoch e + 2 on. Readers
+  // only have to drain out of the old half, never all be idle at once.
+  struct alignas(CACHE_LINE_SIZE) ReaderSlot
+  {
+    std::atomic<uint32_t> active[2] = {{0}, {0}};
+    // lock-free lookups count here, on a line the reader already owns
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+  };
+  // a load in progress, waiters sleep on cv with mutex_
+  struct Flight
+  {
+    std::condition_variable cv;
+    bool done = false;
+    bool failed = false;
+  };
+
   void LRU_Remove(LRUEntry *e);
   void LRU_Append(LRUEntry *list, LRUEntry *e);
+  void LRU_Insert(LRUEntry *e);
+  void MaintainPoolSize();
   void Ref(LRUEntry *e);
   void Unref(LRUEntry *e);
   bool FinishErase(LRUEntry *e);
+  LRUEntry *InsertLocked(const Slice &key, uint32_t hash, void *value, size_t charge, uint64_t ttl_ms,
+                         LRUPriority pri = kLowPriority);
+  void ExpireLocked(uint64_t now_ms);
+  static bool Expired(const LRUEntry *e)
+  {
+    return e->timer.expire != 0 && e->timer.expire <= NowMs();
+  }
+  bool Admit(const Slice &key, uint32_t hash, size_t charge);
+  void Prefetch(const uint32_t *hashes, size_t n) const;
+
+  LRUEntry *LookupLockFree(const Slice &key, uint32_t hash, bool count);
+  LRUEntry *FindAndPin(const Slice &key, uint32_t hash);
+  void ReleaseLockFree(LRUEntry *e);
+  bool TryEvict(LRUEntry *e, const function<bool(void *value)> &evictable = nullptr);
+  void EvictClock();
+  void FreeEntry(LRUEntry *e);
+  std::unique_lock<std::mutex> Lock();
+  static void Count(std::atomic<uint64_t> &c) { c.fetch_add(1, std::memory_order_relaxed); }
+  void DeallocEntry(LRUEntry *e) { alloc_->Free(e, sizeof(LRUEntry) - 1 + e->key_length); }
+  void ReclaimRetired();
+  static uint32_t ReaderSlotIndex();
+  // return the half of slot the reader is counted in, pass it to ExitReader
+  uint32_t EnterReader(ReaderSlot &slot)
+  {
+    uint32_t half = epoch_.load(std::memory_order_seq_cst) & 1;
+    slot.active[half].fetch_add(1, std::memory_order_seq_cst);
+    return half;
+  }
+  static void ExitReader(ReaderSlot &slot, uint32_t half)
+  {
+    slot.active[half].fetch_sub(1, std::memory_order_release);
+  }
 
   size_t capacity_;
+  bool lock_free_;
 
   // mutex_ protects the following state.
   mutable std::mutex mutex_;
+  // sum of the charges of entries in the cache
   size_t usage_;
 
   // Entries have refs==1 and in_cache==true.
+  // In lock-free mode all cached entries live here, pinned or not.
   LRUEntry lru_;
+  // last entry of the cold segment of lru_, &lru_ if it is empty
+  LRUEntry *lru_low_pri_;
+  double high_pri_pool_ratio_ = 0;
+  size_t high_pri_pool_capacity_ = 0;
+  size_t high_pri_pool_usage_ = 0;
   // Entries are in use by clients, and have refs >= 2 and in_cache==true.
   LRUEntry in_use_;
   function<void(const Slice&, void* value)> deleter_;
   HashTable table_;
+  // entries already passed to deleter_, with the epoch they were retired in
+  std::vector<std::pair<uint64_t, LRUEntry *>> retired_;
+  // written under mutex_, read by lock-free readers
+  std::atomic<uint64_t> epoch_{0};
+  // optional, records lookups without mutex_
+  std::unique_ptr<TinyLFU> admission_;
+  // keys being loaded by LookupOrLoad
+  std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+  // created by the first Insert with a ttl, holds the entries which expire
+  std::unique_ptr<TimerWheel> wheel_;
+  uint64_t tick_ms_ = 10;
+  std::unique_ptr<EntryAllocator> alloc_;
+
+  // relaxed counters, on their own cache line away from mutex_
+  struct alignas(CACHE_LINE_SIZE) Counters
+  {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> inserts{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> erase_pinned{0};
+    std::atomic<uint32_t> lock_calls{0};
+  };
+  Counters stats_;
+  uint32_t lock_sample_every_ = 0;
+  // guarded by mutex_
+  Histogram lock_wait_;
+
+  ReaderSlot readers_[kReaderSlots];
 };
 
-inline LRUCache::LRUCache() : capacity_(0), usage_(0)
+inline LRUCache::LRUCache() : capacity_(0), lock_free_(false), usage_(0), alloc_(new SlabEntryAllocator)
 {
   // Make empty circular linked lists.
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  lru_low_pri_ = &lru_;
   in_use_.next = &in_use_;
   in_use_.prev = &in_use_;
+  lock_wait_.Clear();
 }
 
 inline LRUCache::~LRUCache()
 {
   // no client is using 
   assert(in_use_.next == &in_use_);
+  lock_free_ = false;
   for (LRUEntry *e = lru_.next; e != &lru_;)
   {
     LRUEntry *next = e->next;
@@ -198,6 +638,10 @@ inline LRUCache::~LRUCache()
     Unref(e);
     e = next;
   }
+  for (auto &r : retired_)
+  {
+    DeallocEntry(r.second);
+  }
 }
 
 inline void LRUCache::Ref(LRUEntry *e)
@@ -212,17 +656,26 @@ inline void LRUCache::Ref(LRUEntry *e)
 
 inline void LRUCache::Unref(LRUEntry *e)
 {
+  if (lock_free_) {
+    // entries never move between lists, dropping the last ref frees it
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+      assert(!e->in_cache);
+      deleter_(e->key(), e->value);
+      FreeEntry(e);
+    }
+    return;
+  }
   assert(e->refs > 0);
   e->refs--;
   if (e->refs == 0) { 
     // Deallocate.
     assert(!e->in_cache);
     deleter_(e->key(), e->value);
-    free(e);
+    DeallocEntry(e);
   } else if (e->in_cache && e->refs == 1) {
     // No longer in use; move to lru_ list.
     LRU_Remove(e);
-    LRU_Append(&lru_, e);
+    LRU_Insert(e);
   }
   // if incache==false but refs==1, means one client has removed entry, but currently has client reading
   // cannot delete yet.
@@ -230,8 +683,15 @@ inline void LRUCache::Unref(LRUEntry *e)
 
 inline void LRUCache::LRU_Remove(LRUEntry *e)
 {
+  if (lru_low_pri_ == e) {
+    lru_low_pri_ = e->prev;
+  }
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->in_high_pool) {
+    e->in_high_pool = false;
+    high_pri_pool_usage_ -= e->charge;
+  }
 }
 
 inline void LRUCache::LRU_Append(LRUEntry *list, LRUEntry *e)
@@ -243,47 +703,260 @@ inline void LRUCache::LRU_Append(LRUEntry *list, LRUEntry *e)
   e->next->prev = e;
 }
 
-inline LRUEntry *LRUCache::Lookup(const Slice &key, uint32_t hash)
+// put a released entry on lru_: hot entries at the newest end, the others at
+// the newest end of the cold segment
+inline void LRUCache::LRU_Insert(LRUEntry *e)
 {
-  std::lock_guard<std::mutex> l(mutex_);
+  if (high_pri_pool_ratio_ == 0) {
+    LRU_Append(&lru_, e);
+    return;
+  }
+  if (e->high_pri || e->referenced) {
+    LRU_Append(&lru_, e);
+    e->in_high_pool = true;
+    high_pri_pool_usage_ += e->charge;
+    MaintainPoolSize();
+  } else {
+    e->next = lru_low_pri_->next;
+    e->prev = lru_low_pri_;
+    e->prev->next = e;
+    e->next->prev = e;
+    lru_low_pri_ = e;
+  }
+}
+
+// demote the oldest hot entries while the hot segment is over its share
+inline void LRUCache::MaintainPoolSize()
+{
+  while (high_pri_pool_usage_ > high_pri_pool_capacity_) {
+    lru_low_pri_ = lru_low_pri_->next;
+    assert(lru_low_pri_ != &lru_ && lru_low_pri_->in_high_pool);
+    lru_low_pri_->in_high_pool = false;
+    high_pri_pool_usage_ -= lru_low_pri_->charge;
+  }
+}
+
+inline LRUEntry *LRUCache::Lookup(const Slice &key, uint32_t hash, bool count)
+{
+  if (admission_ != nullptr) {
+    admission_->Record(hash);
+  }
+  if (lock_free_) {
+    return LookupLockFree(key, hash, count);
+  }
+  std::unique_lock<std::mutex> l = Lock();
   LRUEntry *e = table_.Lookup(key, hash);
+  if (e != nullptr && Expired(e)) {
+    FinishErase(table_.Remove(key, hash));
+    e = nullptr;
+  }
   if (e != nullptr) {
     Ref(e);
+    e->referenced = true;
+  }
+  if (count) {
+    Count(e != nullptr ? stats_.hits : stats_.misses);
   }
   return e;
 }
 
 inline void LRUCache::Release(LRUEntry *handle)
 {
-  std::lock_guard<std::mutex> l(mutex_);
+  if (lock_free_) {
+    ReleaseLockFree(handle);
+    return;
+  }
+  std::unique_lock<std::mutex> l = Lock();
   Unref(handle);
 }
 
 // return the newly created entry
-inline LRUEntry *LRUCache::Insert(const Slice &key, uint32_t hash, void *value)
+inline LRUEntry *LRUCache::Insert(const Slice &key, uint32_t hash, void *value, size_t charge, uint64_t ttl_ms,
+                                  LRUPriority pri)
 {
-  std::lock_guard<std::mutex> l(mutex_);
+  if (admission_ != nullptr) {
+    admission_->Record(hash);
+  }
+  std::unique_lock<std::mutex> l = Lock();
+  LRUEntry *e = InsertLocked(key, hash, value, charge, ttl_ms, pri);
+  if (lock_free_) {
+    ReclaimRetired();
+  }
+  return e;
+}
 
-  LRUEntry *e = (LRUEntry *)malloc(sizeof(LRUEntry) - 1 + key.size());
+inline LRUEntry *LRUCache::LookupOrLoad(const Slice &key, uint32_t hash, const LRULoader &loader,
+                                        LRUPriority pri, bool count)
+{
+  LRUEntry *e = Lookup(key, hash, count);
+  if (e != nullptr) {
+    return e;
+  }
+  std::unique_lock<std::mutex> l = Lock();
+  std::string k = key.ToString();
+  while (true) {
+    e = table_.Lookup(key, hash);
+    if (e != nullptr && !Expired(e)) {
+      // cached in the meantime; under mutex_ the cache ref keeps refs >= 1
+      if (lock_free_) {
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&e->referenced, true, __ATOMIC_RELAXED);
+      } else {
+        Ref(e);
+      }
+      return e;
+    }
+    auto it = flights_.find(k);
+    if (it == flights_.end()) {
+      break;
+    }
+    std::shared_ptr<Flight> f = it->second;
+    f->cv.wait(l, [&f] { return f->done; });
+    if (f->failed) {
+      return nullptr;
+    }
+    // loaded, look again. It may already be evicted (or not admitted),
+    // then this caller loads it itself.
+  }
+  std::shared_ptr<Flight> f = std::make_shared<Flight>();
+  flights_.emplace(k, f);
+  l.unlock();
+  size_t charge = 1;
+  void *value = loader(key, &charge);
+  l.lock();
+  flights_.erase(k);
+  f->done = true;
+  f->failed = (value == nullptr);
+  if (value != nullptr) {
+    e = InsertLocked(key, hash, value, charge, 0, pri);
+  }
+  f->cv.notify_all();
+  if (lock_free_) {
+    ReclaimRetired();
+  }
+  return e;
+}
+
+inline void LRUCache::Prefetch(const uint32_t *hashes, size_t n) const
+{
+  for (size_t i = 0; i < n; i++) {
+    table_.PrefetchBucket(hashes[i]);
+  }
+  for (size_t i = 0; i < n; i++) {
+    table_.PrefetchHead(hashes[i]);
+  }
+}
+
+inline void LRUCache::MultiLookup(const Slice *keys, const uint32_t *hashes, size_t n, LRUEntry **handles)
+{
+  if (admission_ != nullptr) {
+    for (size_t i = 0; i < n; i++) {
+      admission_->Record(hashes[i]);
+    }
+  }
+  if (lock_free_) {
+    ReaderSlot &slot = readers_[ReaderSlotIndex()];
+    uint32_t half = EnterReader(slot);
+    Prefetch(hashes, n);
+    for (size_t i = 0; i < n; i++) {
+      handles[i] = FindAndPin(keys[i], hashes[i]);
+      Count(handles[i] != nullptr ? slot.hits : slot.misses);
+    }
+    ExitReader(slot, half);
+    return;
+  }
+  std::unique_lock<std::mutex> l = Lock();
+  Prefetch(hashes, n);
+  for (size_t i = 0; i < n; i++) {
+    LRUEntry *e = table_.Lookup(keys[i], hashes[i]);
+    if (e != nullptr && Expired(e)) {
+      FinishErase(table_.Remove(keys[i], hashes[i]));
+      e = nullptr;
+    }
+    if (e != nullptr) {
+      Ref(e);
+      e->referenced = true;
+      Count(stats_.hits);
+    } else {
+      Count(stats_.misses);
+    }
+    handles[i] = e;
+  }
+}
+
+inline void LRUCache::MultiInsert(const Slice *keys, const uint32_t *hashes, void *const *values,
+                                  const size_t *charges, size_t n, LRUEntry **handles)
+{
+  if (admission_ != nullptr) {
+    for (size_t i = 0; i < n; i++) {
+      admission_->Record(hashes[i]);
+    }
+  }
+  std::unique_lock<std::mutex> l = Lock();
+  Prefetch(hashes, n);
+  for (size_t i = 0; i < n; i++) {
+    handles[i] = InsertLocked(keys[i], hashes[i], values[i], charges == nullptr ? 1 : charges[i], 0);
+  }
+  if (lock_free_) {
+    ReclaimRetired();
+  }
+}
+
+// REQUIRES: mutex_ held
+inline LRUEntry *LRUCache::InsertLocked(const Slice &key, uint32_t hash, void *value, size_t charge, uint64_t ttl_ms,
+                                        LRUPriority pri)
+{
+  LRUEntry *e = (LRUEntry *)alloc_->Allocate(sizeof(LRUEntry) - 1 + key.size());
   e->value = value;
+  e->charge = charge;
   e->key_length = key.size();
   e->hash = hash;
   e->refs = 1;
   e->in_cache = false;
+  e->referenced = false;
+  e->high_pri = (pri == kHighPriority);
+  e->in_high_pool = false;
+  e->timer.prev = e->timer.next = nullptr;
+  e->timer.expire = 0;
   std::memcpy(e->key_data, key.data(), key.size());
 
+  if (admission_ != nullptr && !Admit(key, hash, charge)) {
+    // rejected, the caller owns the only reference, like capacity_==0
+    e->next = nullptr;
+    return e;
+  }
+  Count(stats_.inserts);
   if (capacity_ > 0) {
     e->refs++; // client引用
     e->in_cache = true;
-    LRU_Append(&in_use_, e);
-    usage_++;
+    LRU_Append(lock_free_ ? &lru_ : &in_use_, e);
+    usage_ += charge;
+    uint64_t now = (ttl_ms > 0 || wheel_ != nullptr) ? NowMs() : 0;
+    if (ttl_ms > 0) {
+      // set before the entry is published to lock-free readers
+      e->timer.expire = now + ttl_ms;
+    }
     //如果是替换，删除旧值
     FinishErase(table_.Insert(e));
+    if (ttl_ms > 0) {
+      if (wheel_ == nullptr) {
+        wheel_.reset(new TimerWheel(tick_ms_, now));
+      }
+      wheel_->Add(&e->timer);
+    }
+    if (wheel_ != nullptr) {
+      // expired entries go before live ones are evicted
+      ExpireLocked(now);
+    }
   } else { 
     // don't cache. (capacity_==0 is not supported and turns off caching.)
     assert(false);
     e->next = nullptr;
   }
+  if (lock_free_) {
+    EvictClock();
+    return e;
+  }
   while (usage_ > capacity_ && lru_.next != &lru_) {
     // list head is the oldest
     LRUEntry *oldest = lru_.next;
@@ -292,10 +965,28 @@ inline LRUEntry *LRUCache::Insert(const Slice &key, uint32_t hash, void *value)
     if (!erased){
       assert(erased);
     }
+    Count(stats_.evictions);
   }
   return e;
 }
 
+// REQUIRES: mutex_ held. Compare a new key against the entry it would evict.
+// The access was recorded by the caller: Insert, or the Lookup that
+// LookupOrLoad started with, so a load counts once.
+inline bool LRUCache::Admit(const Slice &key, uint32_t hash, size_t charge)
+{
+  if (usage_ + charge <= capacity_ || table_.Lookup(key, hash) != nullptr) {
+    // room left, or an update of a cached key
+    return true;
+  }
+  LRUEntry *victim = lru_.next;
+  if (victim == &lru_) {
+    // everything is pinned, nothing to compare with
+    return true;
+  }
+  return admission_->Admit(hash, victim->hash);
+}
+
 // If e != nullptr, finish removing *e from the cache; it has already been
 // removed from the hash table.
 // meanwhile, might have client reading cannot delete it
@@ -304,9 +995,12 @@ inline bool LRUCache::FinishErase(LRUEntry *e)
   if (e != nullptr)
   {
     assert(e->in_cache);
+    if (wheel_ != nullptr) {
+      wheel_->Remove(&e->timer);
+    }
     LRU_Remove(e);
     e->in_cache = false;
-    usage_--;
+    usage_ -= e->charge;
     Unref(e);
   }
   return e != nullptr;
@@ -314,13 +1008,30 @@ inline bool LRUCache::FinishErase(LRUEntry *e)
 
 inline void LRUCache::Erase(const Slice &key, uint32_t hash)
 {
-  std::lock_guard<std::mutex> l(mutex_);
-  FinishErase(table_.Remove(key, hash));
+  std::unique_lock<std::mutex> l = Lock();
+  LRUEntry *e = table_.Remove(key, hash);
+  if (e != nullptr && __atomic_load_n(&e->refs, __ATOMIC_RELAXED) > 1) {
+    // a client still holds it, the memory outlives the erase
+    Count(stats_.erase_pinned);
+  }
+  FinishErase(e);
+  if (lock_free_) {
+    ReclaimRetired();
+  }
 }
 
 inline void LRUCache::Prune()
 {
   std::lock_guard<std::mutex> l(mutex_);
+  if (lock_free_) {
+    for (LRUEntry *e = lru_.next; e != &lru_;) {
+      LRUEntry *next = e->next;
+      TryEvict(e);
+      e = next;
+    }
+    ReclaimRetired();
+    return;
+  }
   while (lru_.next != &lru_)
   {
     LRUEntry *e = lru_.next;
@@ -332,6 +1043,276 @@ inline void LRUCache::Prune()
   }
 }
 
+inline bool LRUCache::EvictOne(bool cold_only, const function<bool(void *value)> &evictable)
+{
+  std::unique_lock<std::mutex> l = Lock();
+  if (lock_free_) {
+    // pinned entries stay on lru_, take the first one only the cache holds
+    for (LRUEntry *e = lru_.next; e != &lru_; e = e->next) {
+      if (TryEvict(e, evictable)) {
+        Count(stats_.evictions);
+        ReclaimRetired();
+        return true;
+      }
+    }
+    return false;
+  }
+  // the cold segment comes first on lru_
+  for (LRUEntry *e = lru_.next; e != &lru_ && !(cold_only && e->in_high_pool); e = e->next) {
+    assert(e->refs == 1);
+    if (evictable && !evictable(e->value)) {
+      continue;
+    }
+    FinishErase(table_.Remove(e->key(), e->hash));
+    Count(stats_.evictions);
+    return true;
+  }
+  return false;
+}
+
+inline void LRUCache::Expire(uint64_t now_ms)
+{
+  std::lock_guard<std::mutex> l(mutex_);
+  if (wheel_ == nullptr) {
+    return;
+  }
+  ExpireLocked(now_ms);
+  if (lock_free_) {
+    ReclaimRetired();
+  }
+}
+
+// REQUIRES: mutex_ held, wheel_ != nullptr
+inline void LRUCache::ExpireLocked(uint64_t now_ms)
+{
+  wheel_->Advance(now_ms, [this](TimerNode *n) {
+    LRUEntry *e = reinterpret_cast<LRUEntry *>(reinterpret_cast<char *>(n) - offsetof(LRUEntry, timer));
+    LRUEntry *removed = table_.Remove(e->key(), e->hash);
+    assert(removed == e);
+    FinishErase(removed);
+  });
+}
+
+inline uint32_t LRUCache::ReaderSlotIndex()
+{
+  static thread_local uint32_t slot =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % kReaderSlots;
+  return slot;
+}
+
+// find the entry and pin it without mutex_.
+// refs==0 means the entry is dying, treat it as a miss.
+inline LRUEntry *LRUCache::LookupLockFree(const Slice &key, uint32_t hash, bool count)
+{
+  ReaderSlot &slot = readers_[ReaderSlotIndex()];
+  uint32_t half = EnterReader(slot);
+  LRUEntry *e = FindAndPin(key, hash);
+  ExitReader(slot, half);
+  if (count) {
+    Count(e != nullptr ? slot.hits : slot.misses);
+  }
+  return e;
+}
+
+// REQUIRES: caller is counted in its reader slot
+inline LRUEntry *LRUCache::FindAndPin(const Slice &key, uint32_t hash)
+{
+  LRUEntry *e = table_.LookupConcurrent(key, hash);
+  if (e != nullptr && Expired(e)) {
+    // left for Expire() or the next writer to reclaim
+    e = nullptr;
+  }
+  if (e != nullptr) {
+    uint32_t refs = __atomic_load_n(&e->refs, __ATOMIC_ACQUIRE);
+    do {
+      if (refs == 0) {
+        e = nullptr;
+        break;
+      }
+    } while (!__atomic_compare_exchange_n(&e->refs, &refs, refs + 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    // only write the cache line when the bit is not set yet
+    if (e != nullptr && !__atomic_load_n(&e->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&e->referenced, true, __ATOMIC_RELAXED);
+    }
+  }
+  return e;
+}
+
+inline void LRUCache::ReleaseLockFree(LRUEntry *e)
+{
+  if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    // the cache has dropped its reference, we are the last one
+    std::unique_lock<std::mutex> l = Lock();
+    assert(!e->in_cache);
+    deleter_(e->key(), e->value);
+    FreeEntry(e);
+    ReclaimRetired();
+  }
+}
+
+// evict e if only the cache holds it. REQUIRES: mutex_ held, lock-free mode
+inline bool LRUCache::TryEvict(LRUEntry *e, const function<bool(void *value)> &evictable)
+{
+  uint32_t expected = 1;
+  if (!__atomic_compare_exchange_n(&e->refs, &expected, 0, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return false;
+  }
+  if (evictable && !evictable(e->value)) {
+    // readers saw a dying entry meanwhile and missed, nobody else holds it
+    __atomic_store_n(&e->refs, 1, __ATOMIC_RELEASE);
+    return false;
+  }
+  LRUEntry *removed = table_.Remove(e->key(), e->hash);
+  assert(removed == e);
+  (void)removed;
+  if (wheel_ != nullptr) {
+    wheel_->Remove(&e->timer);
+  }
+  LRU_Remove(e);
+  e->in_cache = false;
+  usage_ -= e->charge;
+  deleter_(e->key(), e->value);
+  FreeEntry(e);
+  return true;
+}
+
+// CLOCK sweep from the oldest entry. Referenced entries get a second chance,
+// pinned ones are skipped; two rounds are enough to find a victim if any.
+inline void LRUCache::EvictClock()
+{
+  size_t budget = 2 * table_.Size() + 1;
+  while (usage_ > capacity_ && lru_.next != &lru_ && budget-- > 0) {
+    LRUEntry *e = lru_.next;
+    if (__atomic_load_n(&e->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&e->referenced, false, __ATOMIC_RELAXED);
+    } else if (TryEvict(e)) {
+      Count(stats_.evictions);
+      continue;
+    }
+    LRU_Remove(e);
+    LRU_Append(&lru_, e);
+  }
+}
+
+inline void LRUCache::Snapshot(const LRUEncoder &encode, std::string *dst)
+{
+  struct Saved {
+    LRUEntry *e;
+    uint64_t deadline;
+  };
+  std::vector<Saved> saved;
+  {
+    std::unique_lock<std::mutex> l = Lock();
+    const uint64_t now = wheel_ != nullptr ? NowMs() : 0;
+    const uint64_t wall = WallMs();
+    // pinned entries count as the most recently used
+    for (LRUEntry *list : {&lru_, &in_use_}) {
+      for (LRUEntry *e = list->next; e != list; e = e->next) {
+        if (!Expired(e)) {
+          saved.push_back({e, e->timer.expire == 0 ? 0 : wall + (e->timer.expire - now)});
+        }
+      }
+    }
+    // pin after the walk, Ref moves entries from lru_ to in_use_
+    for (Saved &s : saved) {
+      if (lock_free_) {
+        __atomic_add_fetch(&s.e->refs, 1, __ATOMIC_ACQ_REL);
+      } else {
+        Ref(s.e);
+      }
+    }
+  }
+  std::string value;
+  PutVarint32(dst, saved.size());
+  // releasing oldest first puts the entries back in their LRU order
+  for (Saved &s : saved) {
+    value.clear();
+    encode(s.e->key(), s.e->value, &value);
+    PutLengthPrefixedSlice(dst, s.e->key());
+    PutVarint64(dst, s.e->charge);
+    PutVarint64(dst, s.deadline);
+    PutLengthPrefixedSlice(dst, value);
+    Release(s.e);
+  }
+}
+
+// mutex_.lock(), timing the wait of every lock_sample_every_-th call
+inline std::unique_lock<std::mutex> LRUCache::Lock()
+{
+  if (lock_sample_every_ == 0 ||
+      stats_.lock_calls.fetch_add(1, std::memory_order_relaxed) % lock_sample_every_ != 0) {
+    return std::unique_lock<std::mutex>(mutex_);
+  }
+  double wait = 0;
+  if (!mutex_.try_lock()) {
+    auto start = std::chrono::steady_clock::now();
+    mutex_.lock();
+    wait = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  }
+  lock_wait_.Add(wait);
+  return std::unique_lock<std::mutex>(mutex_, std::adopt_lock);
+}
+
+inline CacheStats LRUCache::GetStats() const
+{
+  CacheStats st;
+  st.hits = stats_.hits.load(std::memory_order_relaxed);
+  st.misses = stats_.misses.load(std::memory_order_relaxed);
+  for (int i = 0; i < kReaderSlots; i++) {
+    st.hits += readers_[i].hits.load(std::memory_order_relaxed);
+    st.misses += readers_[i].misses.load(std::memory_order_relaxed);
+  }
+  st.inserts = stats_.inserts.load(std::memory_order_relaxed);
+  st.evictions = stats_.evictions.load(std::memory_order_relaxed);
+  st.erase_pinned = stats_.erase_pinned.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> l(mutex_);
+  st.lock_wait.Merge(lock_wait_);
+  return st;
+}
+
+// lock-free readers may still be traversing e, defer the free.
+inline void LRUCache::FreeEntry(LRUEntry *e)
+{
+  if (lock_free_) {
+    retired_.emplace_back(epoch_.load(std::memory_order_relaxed), e);
+  } else {
+    DeallocEntry(e);
+  }
+}
+
+// REQUIRES: mutex_ held. Everything retired so far has been unlinked.
+// A reader that entered before an unlink of epoch e sits in half e & 1 or
+// the other one; reaching e + 2 waits for both halves to drain once.
+inline void LRUCache::ReclaimRetired()
+{
+  if (retired_.empty() && !table_.HasRetired()) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+  // readers of the previous epoch are gone: move on
+  uint32_t old_half = (epoch + 1) & 1;
+  bool drained = true;
+  for (int i = 0; i < kReaderSlots && drained; i++) {
+    drained = readers_[i].active[old_half].load(std::memory_order_acquire) == 0;
+  }
+  if (drained) {
+    epoch_.store(++epoch, std::memory_order_seq_cst);
+    table_.SetEpoch(epoch);
+  }
+  if (epoch < 2) {
+    return;
+  }
+  size_t n = 0;
+  while (n < retired_.size() && retired_[n].first + 2 <= epoch) {
+    DeallocEntry(retired_[n++].second);
+  }
+  retired_.erase(retired_.begin(), retired_.begin() + n);
+  table_.FreeRetired(epoch - 1);
+}
+
 static const int kNumShardBits = 4;
 static const int kNumShards = 1 << kNumShardBits;
 
@@ -340,6 +1321,14 @@ class ShardedLRUCache
 private:
   LRUCache shard_[kNumShards];
 
+  // background expiry, see StartExpiry
+  std::thread *expire_thread_ = nullptr;
+  std::mutex expire_mu_;
+  std::condition_variable expire_cv_;
+  bool expire_stop_ = false;
+  // first shard EvictOne tries
+  std::atomic<uint32_t> evict_cursor_{0};
+
   static inline uint32_t HashSlice(const Slice &s)
   {
     return Hash(s.data(), s.size(), dict_hash_function_seed);
@@ -347,7 +1336,82 @@ private:
 
   static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
 
+  static const uint32_t kSnapshotMagic = 0x324c5253; // "SRL2", wall clock deadlines
+
+  // one shard section of a snapshot, see LRUCache::Snapshot
+  bool LoadSection(Slice input, const LRUDecoder &decode)
+  {
+    uint32_t count;
+    if (!GetVarint32(&input, &count))
+    {
+      return false;
+    }
+    const uint64_t now = LRUCache::WallMs();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Slice key, data;
+      uint64_t charge, deadline;
+      if (!GetLengthPrefixedSlice(&input, &key) || !GetVarint64(&input, &charge) ||
+          !GetVarint64(&input, &deadline) || !GetLengthPrefixedSlice(&input, &data))
+      {
+        return false;
+      }
+      if (deadline != 0 && deadline <= now)
+      {
+        continue; // expired while the cache was down
+      }
+      const uint64_t ttl_ms = deadline == 0 ? 0 : deadline - now;
+      void *value = decode(key, data);
+      if (value != nullptr)
+      {
+        const uint32_t hash = HashSlice(key);
+        LRUCache &shard = shard_[Shard(hash)];
+        shard.Release(shard.Insert(key, hash, value, charge, ttl_ms));
+      }
+    }
+    return true;
+  }
+
+  // Hash every key up front and bucket them by shard (counting sort), so
+  // shard s owns [start[s], start[s + 1]) of the sorted arrays.
+  struct Batch
+  {
+    std::vector<Slice> keys;
+    std::vector<uint32_t> hashes;
+    std::vector<uint32_t> index; // position in the caller's arrays
+    std::vector<LRUEntry *> handles;
+    size_t start[kNumShards + 1];
+
+    explicit Batch(const std::vector<Slice> &in)
+        : keys(in.size()), hashes(in.size()), index(in.size()), handles(in.size())
+    {
+      const size_t n = in.size();
+      std::vector<uint32_t> h(n);
+      size_t count[kNumShards] = {0};
+      for (size_t i = 0; i < n; i++)
+      {
+        h[i] = HashSlice(in[i]);
+        count[Shard(h[i])]++;
+      }
+      start[0] = 0;
+      for (int s = 0; s < kNumShards; s++)
+      {
+        start[s + 1] = start[s] + count[s];
+      }
+      size_t pos[kNumShards];
+      std::memcpy(pos, start, sizeof(pos));
+      for (size_t i = 0; i < n; i++)
+      {
+        size_t j = pos[Shard(h[i])]++;
+        keys[j] = in[i];
+        hashes[j] = h[i];
+        index[j] = i;
+      }
+    }
+  };
+
 public:
+  // capacity is the total charge of all shards, entries default to charge 1
   explicit ShardedLRUCache(size_t capacity, function<void(const Slice&, void*)> deleter=[](const Slice&, void* ){})
   {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
@@ -358,17 +1422,158 @@ public:
     }
   }
 
-  ~ShardedLRUCache() {}
+  ~ShardedLRUCache()
+  {
+    if (expire_thread_ != nullptr)
+    {
+      {
+        std::lock_guard<std::mutex> l(expire_mu_);
+        expire_stop_ = true;
+      }
+      expire_cv_.notify_one();
+      expire_thread_->join();
+      delete expire_thread_;
+    }
+  }
+  // Reclaim expired entries from a background thread every tick_ms, so
+  // they stop taking capacity without waiting for LRU. Call before the
+  // first Insert, it also sets the timer wheel resolution of every shard.
+  void StartExpiry(uint64_t tick_ms = 10)
+  {
+    assert(expire_thread_ == nullptr && tick_ms > 0);
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetExpireTick(tick_ms);
+    }
+    expire_thread_ = new std::thread([this, tick_ms]() {
+      std::unique_lock<std::mutex> l(expire_mu_);
+      while (!expire_cv_.wait_for(l, std::chrono::milliseconds(tick_ms), [this] { return expire_stop_; }))
+      {
+        l.unlock();
+        Expire();
+        l.lock();
+      }
+    });
+  }
+  // see LRUCache::SetHighPriPoolRatio, call before the first Insert
+  void SetHighPriPoolRatio(double ratio)
+  {
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetHighPriPoolRatio(ratio);
+    }
+  }
+  // see LRUCache::SetLockFreeLookup, call before the first Insert
+  void SetLockFreeLookup(bool on)
+  {
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetLockFreeLookup(on);
+    }
+  }
+  // see LRUCache::SetAdmission, entries is the expected total entry count
+  void EnableAdmission(size_t entries)
+  {
+    const size_t per_shard = (entries + (kNumShards - 1)) / kNumShards;
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetAdmission(per_shard);
+    }
+  }
+  // see LRUCache::SetEntryAllocator, factory is called once per shard
+  void SetEntryAllocator(const function<EntryAllocator *()> &factory)
+  {
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetEntryAllocator(factory());
+    }
+  }
   LRUEntry *Insert(const Slice &key, void *value)
+  {
+    return Insert(key, value, 1);
+  }
+  // charge is counted against capacity, e.g. the value size in bytes
+  LRUEntry *Insert(const Slice &key, void *value, size_t charge)
+  {
+    return Insert(key, value, charge, 0);
+  }
+  // ttl_ms == 0 never expires
+  LRUEntry *Insert(const Slice &key, void *value, size_t charge, uint64_t ttl_ms)
+  {
+    return Insert(key, value, charge, ttl_ms, kLowPriority);
+  }
+  // see LRUPriority, matters only with SetHighPriPoolRatio
+  LRUEntry *Insert(const Slice &key, void *value, size_t charge, uint64_t ttl_ms, LRUPriority pri)
   {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, ttl_ms, pri);
   }
   LRUEntry *Lookup(const Slice &key)
   {
     const uint32_t hash = HashSlice(key);
     return shard_[Shard(hash)].Lookup(key, hash);
   }
+  // see LRUCache::LookupOrLoad, nullptr if the loader fails
+  LRUEntry *LookupOrLoad(const Slice &key, const LRULoader &loader, LRUPriority pri = kLowPriority,
+                         bool count = true)
+  {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].LookupOrLoad(key, hash, loader, pri, count);
+  }
+  // (*handles)[i] is nullptr if keys[i] misses, every hit must be Released.
+  // Each shard lock is taken once per batch.
+  void MultiLookup(const std::vector<Slice> &keys, std::vector<LRUEntry *> *handles)
+  {
+    Batch b(keys);
+    for (int s = 0; s < kNumShards; s++)
+    {
+      size_t n = b.start[s + 1] - b.start[s];
+      if (n > 0)
+      {
+        size_t off = b.start[s];
+        shard_[s].MultiLookup(&b.keys[off], &b.hashes[off], n, &b.handles[off]);
+      }
+    }
+    handles->resize(keys.size());
+    for (size_t j = 0; j < keys.size(); j++)
+    {
+      (*handles)[b.index[j]] = b.handles[j];
+    }
+  }
+  // charges may be nullptr (every entry charged 1). If a key repeats in one
+  // batch the later value wins, as with sequential Inserts.
+  void MultiInsert(const std::vector<Slice> &keys, const std::vector<void *> &values,
+                   std::vector<LRUEntry *> *handles, const std::vector<size_t> *charges = nullptr)
+  {
+    assert(values.size() == keys.size());
+    assert(charges == nullptr || charges->size() == keys.size());
+    Batch b(keys);
+    std::vector<void *> sorted_values(keys.size());
+    std::vector<size_t> sorted_charges(charges == nullptr ? 0 : keys.size());
+    for (size_t j = 0; j < keys.size(); j++)
+    {
+      sorted_values[j] = values[b.index[j]];
+      if (charges != nullptr)
+      {
+        sorted_charges[j] = (*charges)[b.index[j]];
+      }
+    }
+    for (int s = 0; s < kNumShards; s++)
+    {
+      size_t n = b.start[s + 1] - b.start[s];
+      if (n > 0)
+      {
+        size_t off = b.start[s];
+        shard_[s].MultiInsert(&b.keys[off], &b.hashes[off], &sorted_values[off],
+                              charges == nullptr ? nullptr : &sorted_charges[off], n, &b.handles[off]);
+      }
+    }
+    handles->resize(keys.size());
+    for (size_t j = 0; j < keys.size(); j++)
+    {
+      (*handles)[b.index[j]] = b.handles[j];
+    }
+  }
   void Release(LRUEntry *handle)
   {
     LRUEntry *h = reinterpret_cast<LRUEntry *>(handle);
@@ -386,6 +1591,34 @@ public:
       shard_[s].Prune();
     }
   }
+  // Make room outside of the charge accounting, e.g. when a fixed pool of
+  // buffers runs dry: evict one unpinned entry. Shards are tried round
+  // robin from a moving start, cold entries of every shard before hot ones.
+  // false if every entry is pinned or refused by evictable.
+  bool EvictOne(const function<bool(void *value)> &evictable = nullptr)
+  {
+    const uint32_t start = evict_cursor_.fetch_add(1, std::memory_order_relaxed);
+    for (int pass = 0; pass < 2; pass++)
+    {
+      for (int i = 0; i < kNumShards; i++)
+      {
+        if (shard_[(start + i) % kNumShards].EvictOne(pass == 0, evictable))
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+  // drop every expired entry now, StartExpiry does it periodically
+  void Expire()
+  {
+    const uint64_t now = LRUCache::NowMs();
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].Expire(now);
+    }
+  }
   size_t TotalElem() const
   {
     size_t total = 0;
@@ -395,6 +1628,135 @@ public:
     }
     return total;
   }
+  size_t TotalCharge() const
+  {
+    size_t total = 0;
+    for (int s = 0; s < kNumShards; s++)
+    {
+      total += shard_[s].TotalCharge();
+    }
+    return total;
+  }
+  // Warm restart: write the entries of every shard, oldest first, to path.
+  // File: fixed32 magic, fixed32 shard count, fixed64 size of each shard
+  // section, then the sections (see LRUCache::Snapshot). The file is written
+  // and fsynced as path.tmp, renamed, then the directory is fsynced, so a
+  // crash leaves either the old or the new snapshot, never a torn one.
+  bool SaveSnapshot(const std::string &path, const LRUEncoder &encode)
+  {
+    std::string sections[kNumShards];
+    std::string header;
+    PutFixed32(&header, kSnapshotMagic);
+    PutFixed32(&header, kNumShards);
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].Snapshot(encode, &sections[s]);
+      PutFixed64(&header, sections[s].size());
+    }
+    const std::string tmp = path + ".tmp";
+    FILE *out = std::fopen(tmp.c_str(), "wb");
+    if (out == nullptr)
+    {
+      return false;
+    }
+    bool ok = std::fwrite(header.data(), 1, header.size(), out) == header.size();
+    for (int s = 0; s < kNumShards && ok; s++)
+    {
+      ok = std::fwrite(sections[s].data(), 1, sections[s].size(), out) == sections[s].size();
+    }
+    ok = ok && std::fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    // make the rename itself durable
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+  }
+  // Insert the entries saved by SaveSnapshot, one thread per shard section.
+  // Entries keep their charge and deadline; those already past it are
+  // dropped. Returns false if the file is missing or corrupt; sections
+  // parsed before the damage stay cached.
+  bool LoadSnapshot(const std::string &path, const LRUDecoder &decode)
+  {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+      return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t header_size = 8 + 8 * kNumShards;
+    if (data.size() < header_size || DecodeFixed32(data.data()) != kSnapshotMagic ||
+        DecodeFixed32(data.data() + 4) != kNumShards)
+    {
+      return false;
+    }
+    Slice sections[kNumShards];
+    size_t offset = header_size;
+    for (int s = 0; s < kNumShards; s++)
+    {
+      uint64_t size = DecodeFixed64(data.data() + 8 + 8 * s);
+      if (size > data.size() - offset)
+      {
+        return false;
+      }
+      sections[s] = Slice(data.data() + offset, size);
+      offset += size;
+    }
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> loaders;
+    for (int s = 0; s < kNumShards; s++)
+    {
+      loaders.emplace_back([&, s]() {
+        if (!LoadSection(sections[s], decode))
+        {
+          ok.store(false, std::memory_order_relaxed);
+        }
+      });
+    }
+    for (auto &t : loaders)
+    {
+      t.join();
+    }
+    return ok.load(std::memory_order_relaxed);
+  }
+  // see LRUCache::SetLockWaitSampling
+  void SetLockWaitSampling(uint32_t every)
+  {
+    for (int s = 0; s < kNumShards; s++)
+    {
+      shard_[s].SetLockWaitSampling(every);
+    }
+  }
+  // counters of every shard merged
+  CacheStats GetStats() const
+  {
+    CacheStats st;
+    for (int s = 0; s < kNumShards; s++)
+    {
+      st.Merge(shard_[s].GetStats());
+    }
+    return st;
+  }
+  // one snapshot per shard, to spot imbalance
+  void GetShardStats(std::vector<CacheStats> *stats) const
+  {
+    stats->resize(kNumShards);
+    for (int s = 0; s < kNumShards; s++)
+    {
+      (*stats)[s] = shard_[s].GetStats();
+    }
+  }
 };
 
 using SLruCache = ShardedLRUCache;
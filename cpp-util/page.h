@@ -1,6 +1,9 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <new>
 #include "lock.h"
 
 constexpr int PAGE_SIZE = 4 << 10; // 4KB
@@ -8,27 +11,49 @@ constexpr int INVALID_PAGE_ID = -1;
 
 using lsn_t = int32_t;      // log sequence number type
 
-class Page
+// Page metadata plus a pointer to its 4KB of data. PageCache points its
+// frames into one separate data region, so the metadata of all frames packs
+// into a small array and one frame's latch never shares a cache line with
+// another frame. A standalone Page owns its data.
+class alignas(CACHE_LINE_SIZE) Page
 {
 public:
     // Allow PageCache access private members
     friend class PageCache;
-    Page() { ResetMemory(); }
-    ~Page() = default;
+    // 4KB aligned, usable for O_DIRECT
+    Page() : owns_data_(true) {
+        if (posix_memalign((void **)&data_, PAGE_SIZE, PAGE_SIZE) != 0) throw std::bad_alloc();
+        ResetMemory();
+    }
+    // frame: PAGE_SIZE bytes owned by the caller
+    explicit Page(char *frame) : data_(frame) {}
+    ~Page() { if (owns_data_) free(data_); }
+
+    Page(const Page &) = delete;
+    Page &operator=(const Page &) = delete;
+
+    // honour alignas before C++17 aligned new
+    static void *operator new(size_t size) {
+        void *p = nullptr;
+        if (posix_memalign(&p, CACHE_LINE_SIZE, size) != 0) throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete(void *p) { free(p); }
 
     inline char *GetData() { return data_; }
     inline uint32_t GetPageId() { return page_id_; }
     inline void SetPageId(uint32_t page_id) { page_id_ = page_id; }
 
-    inline bool IsDirty() { return is_dirty_; }
+    inline bool IsDirty() { return is_dirty_.load(std::memory_order_relaxed); }
 
     inline void WLatch() { rwlatch_.WriteLock(); }
     inline void WUnlatch() { rwlatch_.WriteUnlock(); }
+    inline bool TryWLatch() { return rwlatch_.TryWriteLock(); }
 
     inline void RLatch() { rwlatch_.ReadLock(); }
     inline void RUnlatch() { rwlatch_.ReadUnlock(); }
 
-    inline void ResetMemory() { memset(data_, 0, PAGE_SIZE); }
+    inline void ResetMemory() { if (data_ != nullptr) memset(data_, 0, PAGE_SIZE); }
 
 protected:
     static_assert(sizeof(uint32_t) == 4);
@@ -39,8 +64,12 @@ protected:
     static constexpr size_t OFFSET_LSN = 4;
 
 private:
-    char data_[PAGE_SIZE]{0};
+    char *data_;
+    bool owns_data_ = false;
     uint32_t page_id_ = INVALID_PAGE_ID;
-    bool is_dirty_ = false;
+    // set by PageCache::ReleasePage, cleared by whoever writes the page back
+    std::atomic<bool> is_dirty_{false};
+    // PageCache: the eviction already holds WLatch
+    bool evict_latched_ = false;
     RWMutex rwlatch_;
 };
@@ -1,124 +1,667 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <deque>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
 
 #include "page.h"
 #include "disk_manager.h"
+#include "huge_page.h"
 #include "lrucache.h"
-#include "arena.h"
 #include "slice.h"
 
+class PageCache;
+
+// RAII pin of one page, from PageCache::Pin. The frame cannot be evicted
+// while the guard lives, so the page memory can be used in place. Read()
+// and Write() return views holding the frame's RLatch/WLatch for their
+// lifetime; taking a Write() view marks the page dirty at release.
+class PageGuard
+{
+public:
+    class ReadView
+    {
+    public:
+        explicit ReadView(Page *pg) : pg_(pg) { pg_->RLatch(); }
+        ~ReadView() { if (pg_ != nullptr) pg_->RUnlatch(); }
+        ReadView(ReadView &&o) noexcept : pg_(o.pg_) { o.pg_ = nullptr; }
+        ReadView(const ReadView &) = delete;
+        ReadView &operator=(const ReadView &) = delete;
+        ReadView &operator=(ReadView &&) = delete;
+        const char *data() const { return pg_->GetData(); }
+    private:
+        Page *pg_;
+    };
+    class WriteView
+    {
+    public:
+        explicit WriteView(Page *pg) : pg_(pg) { pg_->WLatch(); }
+        ~WriteView() { if (pg_ != nullptr) pg_->WUnlatch(); }
+        WriteView(WriteView &&o) noexcept : pg_(o.pg_) { o.pg_ = nullptr; }
+        WriteView(const WriteView &) = delete;
+        WriteView &operator=(const WriteView &) = delete;
+        WriteView &operator=(WriteView &&) = delete;
+        char *data() { return pg_->GetData(); }
+    private:
+        Page *pg_;
+    };
+
+    PageGuard() = default;
+    PageGuard(PageCache *cache, LRUEntry *ent) : cache_(cache), ent_(ent) {}
+    ~PageGuard() { Release(); }
+    PageGuard(PageGuard &&o) noexcept : cache_(o.cache_), ent_(o.ent_), dirty_(o.dirty_) {
+        o.ent_ = nullptr;
+    }
+    PageGuard &operator=(PageGuard &&o) noexcept {
+        if (this != &o) {
+            Release();
+            cache_ = o.cache_;
+            ent_ = o.ent_;
+            dirty_ = o.dirty_;
+            o.ent_ = nullptr;
+        }
+        return *this;
+    }
+    PageGuard(const PageGuard &) = delete;
+    PageGuard &operator=(const PageGuard &) = delete;
+
+    // false if every frame was pinned
+    explicit operator bool() const { return ent_ != nullptr; }
+    Page *page() const { return (Page *)ent_->value; }
+    uint32_t PageId() const { return page()->GetPageId(); }
+
+    ReadView Read() const { return ReadView(page()); }
+    WriteView Write() {
+        dirty_ = true;
+        return WriteView(page());
+    }
+    // mark dirty for callers latching the page themselves
+    void SetDirty() { dirty_ = true; }
+    // unpin early, the guard is empty afterwards
+    inline void Release();
+
+private:
+    PageCache *cache_ = nullptr;
+    LRUEntry *ent_ = nullptr;
+    bool dirty_ = false;
+};
+
+// A fixed pool of total_pages frames. A miss takes a free frame, or evicts
+// an unpinned page (written back if dirty) to reuse its frame, so memory
+// never grows past the pool. A fetched page stays pinned until ReleasePage;
+// if every frame is pinned FetchPage returns nullptr.
+//
+// Dirty pages are written back by eviction, FlushAllPages, or the optional
+// background flusher (StartFlusher); the last two sort them by page id and
+// write runs of adjacent pages with one pwritev. A frame's rwlatch guards
+// its identity: the flusher reads it under RLatch, eviction resets it under
+// WLatch, so writers that modify data concurrently should hold WLatch.
+// Eviction only picks a victim whose WLatch it gets without waiting, so a
+// page being flushed is passed over rather than stalling the LRU shard on
+// the flusher's I/O; when every unpinned page is being flushed, the miss
+// retries without holding any shard lock until the flusher lets one go.
+//
+// Frame data come from 2MB huge-page regions, apart from the Page metadata
+// array. With numa_partition the frames are split evenly across the online
+// NUMA nodes, each slice bound to its node, and a miss prefers a free frame on
+// the node of the calling thread. When the DiskManager runs io_uring, the
+// regions are registered with the ring and flushing keeps up to the ring
+// depth of page writes in flight. Frames are PAGE_SIZE aligned inside the
+// 2MB regions, so an O_DIRECT DiskManager reads and writes them in place.
+//
+// With StartReadAhead, FetchPage spots sequential streams of page ids and
+// background workers load the next pages ahead of the reader; Prefetch
+// queues explicit hints on the same workers.
 class PageCache
 {
 public:
-    PageCache(size_t total_pages, DiskManager *disk_manager): 
+    PageCache(size_t total_pages, DiskManager *disk_manager, bool numa_partition = false):
         total_pages_(total_pages), disk_manager_(disk_manager) {
-        pages_ = new Page[total_pages_];
-        cache_ = new ShardedLRUCache(total_pages, [&](const Slice& k, void *val){
-            DeletePageCallBack(k, val);
-            printf("delete page %u\n", *(uint32_t*)k.data());
-        });
-        for (size_t i = 0; i < total_pages_; ++i)
+        // metadata array, constructed once the data regions exist
+        void *meta = nullptr;
+        if (posix_memalign(&meta, CACHE_LINE_SIZE, sizeof(Page) * total_pages_) != 0)
         {
-            free_list_.emplace_back(&pages_[i]);
+            throw std::bad_alloc();
         }
+        pages_ = (Page *)meta;
+        if(numa_partition) {
+            nodes_ = HugePageRegion::NumaNodes();
+            nodes_.resize(std::max<size_t>(1, std::min(nodes_.size(), total_pages_)));
+        }
+        size_t nodes = std::max<size_t>(1, nodes_.size());
+        node_frames_ = (total_pages_ + nodes - 1) / nodes;
+        free_lists_.resize(nodes);
+        for (size_t n = 0; n < nodes; ++n)
+        {
+            size_t begin = n * node_frames_;
+            size_t end = std::min(total_pages_, begin + node_frames_);
+            regions_.emplace_back(new HugePageRegion);
+            char *data = regions_.back()->Allocate((end - begin) * PAGE_SIZE, numa_partition ? nodes_[n] : -1);
+            if (data == nullptr)
+            {
+                DestroyFrames(begin);
+                throw std::bad_alloc();
+            }
+            static_assert(PAGE_SIZE % kDirectIOAlign == 0, "frames must stay O_DIRECT aligned");
+            for (size_t i = begin; i < end; ++i)
+            {
+                ::new (&pages_[i]) Page(data + (i - begin) * PAGE_SIZE);
+                free_lists_[n].emplace_back(&pages_[i]);
+            }
+        }
+        if (disk_manager_->AsyncIOEnabled())
+        {
+            // async I/O on the frames skips the per-I/O page pinning
+            std::vector<struct iovec> bufs;
+            for (auto &r : regions_)
+            {
+                bufs.push_back({r->data(), r->size()});
+            }
+            disk_manager_->RegisterBuffers(bufs);
+        }
+        // the frame pool, not the LRU charge, bounds the cache: every shard
+        // may hold all frames and AllocateFrame evicts when they run out
+        cache_ = new ShardedLRUCache(total_pages * kNumShards, [&](const Slice& k, void *val){
+            DeletePageCallBack(k, val);
+        });
     }
     ~PageCache() {
-        delete[] pages_;
+        StopReadAhead();
+        StopFlusher();
+        // the cache deleter still touches the frames
         delete cache_;
+        // the ring must not keep the old addresses once the regions are unmapped
+        if (disk_manager_->AsyncIOEnabled())
+        {
+            disk_manager_->UnregisterBuffers();
+        }
+        DestroyFrames(total_pages_);
     }
     bool WritePage(uint32_t lba, uint32_t off, const Slice& data) {
-        LRUEntry *ent = FetchPage(lba);
-        if (ent == nullptr) return false;
-        Page* page = (Page*)ent->value;
         if(off + data.size() >= PAGE_SIZE) return false;
-        memcpy(page->data_ + off, data.data(), data.size());
-        ReleasePage(ent, true);
+        PageGuard guard = Pin(lba);
+        if (!guard) return false;
+        memcpy(guard.Write().data() + off, data.data(), data.size());
         return true;
     }
+    // the page is unpinned on return and may be evicted and reused while
+    // the pointer is still read, use Pin to keep it
     char* ReadPage(uint32_t lba, uint32_t off) {
+        if(off >= PAGE_SIZE) return nullptr;
         LRUEntry *ent = FetchPage(lba);
         if (ent == nullptr) return nullptr;
         Page* page = (Page*)ent->value;
-        if(off >= PAGE_SIZE) return nullptr;
         char* ret = page->data_ + off;
         ReleasePage(ent, false);
         return ret;
     }
 
+    // keep ratio of the frames for hot pages, so a scan cannot flush them.
+    // call before the first fetch
+    void SetHighPriPoolRatio(double ratio) {
+        cache_->SetHighPriPoolRatio(ratio);
+    }
     // remember release when not used anymore
-    LRUEntry *FetchPage(uint32_t page_id) {
-        Slice key((char*)&page_id, 4);
-        auto ent = cache_->Lookup(key);
-        if(ent != nullptr) {
-            return ent;
+    // concurrent misses of one page share a single disk read
+    // pri: kHighPriority for pages that should survive scans, e.g. B-tree inner pages
+    // nullptr if every frame is pinned
+    LRUEntry *FetchPage(uint32_t page_id, LRUPriority pri = kLowPriority) {
+        if(readahead_window_ > 0) {
+            DetectSequential(page_id);
         }
-        Page* pg = nullptr;
-        latch_.lock();
-        // free_list 还有空位置
-        if(free_list_.size()) {
-            pg = free_list_.front();
-            free_list_.pop_front();
-        }
-        latch_.unlock();
-        // freelist 没有空位置
-        // 如果插入的cache正好满了，会淘汰掉一个Page，这个Page会放入free_list
-        // 最终结果就是free_list不断变大
-        // TODO：free_list满后，调用淘汰接口，淘汰一个LRUentry，放到free_list
-        if(pg == nullptr) {
-            pg = (Page*)arena_.AllocateAligned(sizeof(Page));
-        }
-        pg->page_id_ = page_id;
-        /* load first */
-        disk_manager_->ReadPage(page_id, pg->GetData());
-        auto ret = cache_->Insert(key, (void*)pg);
-        return ret;
+        return LoadPage(page_id, pri);
+    }
+    // FetchPage wrapped in a PageGuard, empty if every frame is pinned
+    PageGuard Pin(uint32_t page_id, LRUPriority pri = kLowPriority) {
+        return PageGuard(this, FetchPage(page_id, pri));
     }
+    // is_dirty: the caller modified the page; a clean release keeps an
+    // earlier dirty mark
     bool ReleasePage(LRUEntry *ent, bool is_dirty) {
         Page *pg = (Page*)ent->value;
-        pg->is_dirty_ = is_dirty;
+        if(is_dirty && !pg->is_dirty_.exchange(true)) {
+            // wake the flusher when crossing the watermark
+            if(dirty_pages_.fetch_add(1) + 1 == dirty_limit_) {
+                flush_cv_.notify_one();
+            }
+        }
         cache_->Release(ent);
         return true;
     }
+    // false if the page was clean or the write failed, then it stays dirty
     bool FlushPage(Page* pg) {
-        if(pg->IsDirty()) {
-            disk_manager_->WritePage(pg->GetPageId(), pg->GetData());
-            pg->is_dirty_ = false;
-            return true;
+        pg->RLatch();
+        bool flushed = pg->is_dirty_.exchange(false);
+        if(flushed) {
+            dirty_pages_--;
+            if(!disk_manager_->WritePage(pg->GetPageId(), pg->GetData())) {
+                pg->is_dirty_ = true;
+                dirty_pages_++;
+                flushed = false;
+            }
         }
-        return false;
+        pg->RUnlatch();
+        return flushed;
     }
     //删除内存Page，但不会删除影响磁盘Page
     bool DeletePage(uint32_t page_id) {
         cache_->Erase(Slice((char*)&page_id, 4));
         return true;
     }
-    void FlushAllPages() {
-        for(size_t i=0; i<total_pages_; ++i) {
-            FlushPage(&pages_[i]);
+    // write every dirty page, adjacent page ids with one pwritev
+    // false if a write failed, its pages stay dirty
+    bool FlushAllPages() {
+        return FlushDirty() == 0;
+    }
+    // Background write-back: the flusher wakes once the dirty pages reach
+    // dirty_ratio of the frames, or every interval_ms, and flushes all of
+    // them, so eviction rarely finds a dirty victim
+    void StartFlusher(double dirty_ratio = 0.2, uint64_t interval_ms = 1000) {
+        assert(flusher_ == nullptr);
+        dirty_limit_ = std::max<size_t>(1, total_pages_ * dirty_ratio);
+        flusher_ = new std::thread([this, interval_ms]() {
+            std::unique_lock<std::mutex> l(flush_mu_);
+            while(!flush_stop_) {
+                flush_cv_.wait_for(l, std::chrono::milliseconds(interval_ms), [this] {
+                    return flush_stop_ || dirty_pages_ >= dirty_limit_;
+                });
+                l.unlock();
+                FlushDirty();
+                l.lock();
+            }
+        });
+    }
+    void StopFlusher() {
+        if(flusher_ == nullptr) return;
+        {
+            std::lock_guard<std::mutex> l(flush_mu_);
+            flush_stop_ = true;
         }
+        flush_cv_.notify_one();
+        flusher_->join();
+        delete flusher_;
+        flusher_ = nullptr;
+        // a later StartFlusher runs again
+        flush_stop_ = false;
     }
+    inline size_t DirtyPages() const { return dirty_pages_; }
+
+    // window: pages loaded ahead of a sequential stream, 0 for Prefetch
+    // only; streams stop at disk_manager->NextPageId(). threads: workers
+    // doing the reads
+    void StartReadAhead(size_t window = 32, size_t threads = 2) {
+        assert(prefetchers_.empty());
+        // up to 1.5 windows are in flight ahead of the reader, keep them well
+        // inside the pool or prefetched pages evict each other unread
+        readahead_window_ = std::min(window, total_pages_ / 4);
+        for(size_t i = 0; i < threads; ++i) {
+            prefetchers_.emplace_back([this]() { PrefetchLoop(); });
+        }
+    }
+    void StopReadAhead() {
+        if(prefetchers_.empty()) return;
+        {
+            std::lock_guard<std::mutex> l(prefetch_mu_);
+            prefetch_stop_ = true;
+        }
+        prefetch_cv_.notify_all();
+        for(auto &t : prefetchers_) {
+            t.join();
+        }
+        prefetchers_.clear();
+        // a later StartReadAhead runs again
+        prefetch_stop_ = false;
+        readahead_window_ = 0;
+    }
+    // hint that these pages will be fetched soon, they are loaded in the
+    // background. A no-op without StartReadAhead
+    void Prefetch(const std::vector<uint32_t> &page_ids) {
+        Enqueue(page_ids, false);
+    }
+    // pages loaded by the read-ahead workers
+    inline size_t PrefetchedPages() const { return prefetched_; }
+    // prefetches that found the page cached already, not in GetStats
+    inline size_t PrefetchHits() const { return prefetch_hits_; }
     inline Page *GetPages() { return pages_; }
+    // how the frame data are backed, kHugeTLB, kTHP or kNormal
+    inline HugePageRegion::Backing FrameBacking() const { return regions_[0]->backing(); }
+    inline size_t NumaPartitions() const { return free_lists_.size(); }
     inline size_t PageInCacheNum() { return cache_->TotalElem(); }
+    // hits/misses of FetchPage and friends, see ShardedLRUCache::GetStats
+    inline CacheStats GetStats() const { return cache_->GetStats(); }
 private:
+    // destroy the first n frames and free the metadata array
+    void DestroyFrames(size_t n) {
+        for (size_t i = 0; i < n; ++i)
+        {
+            pages_[i].~Page();
+        }
+        free(pages_);
+    }
+    // take a free frame, evicting an unpinned page when there is none.
+    // the eviction returns the victim's frame through DeletePageCallBack,
+    // another miss may grab it first, then try again. If every unpinned
+    // page is latched (being flushed), retry outside the LRU shard locks
+    // until one is released; nullptr only if every frame is pinned
+    Page *AllocateFrame() {
+        size_t home = 0;
+        if(nodes_.size() > 1) {
+            int node = HugePageRegion::CurrentNode();
+            home = std::find(nodes_.begin(), nodes_.end(), node) - nodes_.begin();
+            home = home < nodes_.size() ? home : 0;
+        }
+        while(true) {
+            latch_.lock();
+            // free_list 还有空位置, local node first
+            for(size_t i = 0; i < free_lists_.size(); ++i) {
+                std::list<Page *> &free_list = free_lists_[(home + i) % free_lists_.size()];
+                if(free_list.size()) {
+                    Page *pg = free_list.front();
+                    free_list.pop_front();
+                    latch_.unlock();
+                    return pg;
+                }
+            }
+            latch_.unlock();
+            // 没有空闲frame，淘汰一个未被pin的page, one nobody latches
+            bool latched = false;
+            auto victim = [&latched](void *val) {
+                if(TryLatchVictim(val)) return true;
+                latched = true;
+                return false;
+            };
+            if(!cache_->EvictOne(victim)) {
+                if(!latched) return nullptr;
+                std::this_thread::yield();
+            }
+        }
+    }
+    // loaded: set if this call read the page from disk. Prefetches
+    // (loaded != nullptr) stay out of the hit/miss stats
+    LRUEntry *LoadPage(uint32_t page_id, LRUPriority pri, bool *loaded = nullptr) {
+        Slice key((char*)&page_id, 4);
+        return cache_->LookupOrLoad(key, [&](const Slice&, size_t*) -> void* {
+            Page* pg = AllocateFrame();
+            if(pg == nullptr) {
+                return nullptr;
+            }
+            if(loaded != nullptr) *loaded = true;
+            pg->WLatch();
+            pg->page_id_ = page_id;
+            /* load first */
+            disk_manager_->ReadPage(page_id, pg->GetData());
+            pg->WUnlatch();
+            return (void*)pg;
+        }, pri, loaded == nullptr);
+    }
+    // A stream continues when page_id follows its last page. After two
+    // sequential steps it queues the next window, up to the end of the
+    // file, and again once the reader has used half of what was queued. A
+    // new stream replaces the oldest. Streams are kept per thread shard, so
+    // readers in different shards never share a lock.
+    void DetectSequential(uint32_t page_id) {
+        uint64_t from = 0, to = 0;
+        {
+            StreamShard &shard = stream_shards_[std::hash<std::thread::id>()(std::this_thread::get_id()) % kStreamShards];
+            std::lock_guard<std::mutex> l(shard.mu);
+            ReadStream *s = nullptr;
+            for(ReadStream &cur : shard.streams) {
+                if(cur.run == kNoStream) continue;
+                if(cur.last == page_id) return;
+                if((uint64_t)cur.last + 1 == page_id) s = &cur;
+            }
+            if(s == nullptr) {
+                s = &shard.streams[shard.victim++ % kReadStreams];
+                s->last = page_id;
+                s->run = 0;
+                s->next = (uint64_t)page_id + 1;
+                return;
+            }
+            s->last = page_id;
+            if(++s->run < 2 || s->next > page_id + readahead_window_ / 2) return;
+            from = std::max<uint64_t>(s->next, (uint64_t)page_id + 1);
+            to = std::min<uint64_t>((uint64_t)page_id + readahead_window_ + 1, disk_manager_->NextPageId());
+            s->next = std::max(from, to);
+        }
+        std::vector<uint32_t> ids;
+        for(uint64_t id = from; id < to; ++id) {
+            ids.push_back((uint32_t)id);
+        }
+        if(!ids.empty()) Enqueue(ids, true);
+    }
+    // readahead: queued by a stream, dropped if the reader got there first
+    void Enqueue(const std::vector<uint32_t> &page_ids, bool readahead) {
+        if(prefetchers_.empty()) return;
+        {
+            std::lock_guard<std::mutex> l(prefetch_mu_);
+            for(uint32_t id : page_ids) {
+                // a full queue drops the oldest hints, a reader that outruns
+                // the workers has passed them anyway
+                if(prefetch_queue_.size() >= total_pages_) prefetch_queue_.pop_front();
+                prefetch_queue_.emplace_back(id, readahead);
+            }
+        }
+        prefetch_cv_.notify_all();
+    }
+    // a stream already read past page_id, loading it now would only evict
+    // the pages ahead of the reader
+    bool StreamPassed(uint32_t page_id) {
+        for(StreamShard &shard : stream_shards_) {
+            std::lock_guard<std::mutex> l(shard.mu);
+            for(ReadStream &cur : shard.streams) {
+                if(cur.run != kNoStream && cur.run >= 2 && cur.last >= page_id &&
+                   cur.last - page_id < 2 * readahead_window_) return true;
+            }
+        }
+        return false;
+    }
+    void PrefetchLoop() {
+        std::unique_lock<std::mutex> l(prefetch_mu_);
+        while(true) {
+            prefetch_cv_.wait(l, [this] { return prefetch_stop_ || !prefetch_queue_.empty(); });
+            if(prefetch_stop_) return;
+            uint32_t page_id = prefetch_queue_.front().first;
+            bool readahead = prefetch_queue_.front().second;
+            prefetch_queue_.pop_front();
+            l.unlock();
+            if(readahead && StreamPassed(page_id)) {
+                l.lock();
+                continue;
+            }
+            bool loaded = false;
+            // low priority: with a high-pri pool (SetHighPriPoolRatio) unread
+            // prefetches stay in the cold segment and are evicted first
+            LRUEntry *ent = LoadPage(page_id, kLowPriority, &loaded);
+            if(ent != nullptr) {
+                if(loaded) prefetched_++;
+                else prefetch_hits_++;
+                cache_->Release(ent);
+            }
+            l.lock();
+        }
+    }
+    // snapshot the dirty frames, sorted by page id
+    // return the number of pages whose write failed
+    size_t FlushDirty() {
+        std::vector<std::pair<uint32_t, Page *>> dirty;
+        for(size_t i = 0; i < total_pages_; ++i) {
+            Page *pg = &pages_[i];
+            if(pg->IsDirty()) {
+                pg->RLatch();
+                dirty.emplace_back(pg->page_id_, pg);
+                pg->RUnlatch();
+            }
+        }
+        std::sort(dirty.begin(), dirty.end());
+        if(disk_manager_->AsyncIOEnabled()) {
+            return WriteAsync(dirty);
+        }
+        size_t failed = 0;
+        size_t start = 0;
+        for(size_t i = 1; i <= dirty.size(); ++i) {
+            if(i == dirty.size() || dirty[i].first != dirty[i - 1].first + 1 || i - start == IOV_MAX) {
+                failed += WriteRun(&dirty[start], i - start);
+                start = i;
+            }
+        }
+        return failed;
+    }
+    // write pages with consecutive ids. Under RLatch a frame may turn out
+    // clean or reused meanwhile, it is skipped and splits the run. Every
+    // page of a failed write is dirty again; return how many
+    size_t WriteRun(const std::pair<uint32_t, Page *> *run, size_t n) {
+        std::vector<char *> bufs;
+        std::vector<Page *> pgs;
+        uint32_t first = 0;
+        size_t failed = 0;
+        for(size_t i = 0; i < n; ++i) {
+            run[i].second->RLatch();
+        }
+        for(size_t i = 0; i <= n; ++i) {
+            Page *pg = i < n ? run[i].second : nullptr;
+            bool valid = pg != nullptr && pg->page_id_ == run[i].first && pg->is_dirty_.exchange(false);
+            if(valid) {
+                dirty_pages_--;
+                if(bufs.empty()) first = run[i].first;
+                bufs.push_back(pg->GetData());
+                pgs.push_back(pg);
+            } else if(!bufs.empty()) {
+                if(!disk_manager_->WritePages(first, bufs.data(), bufs.size())) {
+                    for(Page *p : pgs) {
+                        p->is_dirty_ = true;
+                    }
+                    dirty_pages_ += pgs.size();
+                    failed += pgs.size();
+                }
+                bufs.clear();
+                pgs.clear();
+            }
+        }
+        for(size_t i = 0; i < n; ++i) {
+            run[i].second->RUnlatch();
+        }
+        return failed;
+    }
+    // io_uring: every dirty page in flight at once, in page id order.
+    // A failed write leaves its page dirty for the next flush
+    size_t WriteAsync(const std::vector<std::pair<uint32_t, Page *>> &dirty) {
+        std::atomic<size_t> done{0};
+        size_t failed = 0;
+        size_t issued = 0;
+        std::vector<Page *> latched;
+        for(auto &d : dirty) {
+            Page *pg = d.second;
+            pg->RLatch();
+            if(pg->page_id_ == d.first && pg->is_dirty_.exchange(false)) {
+                dirty_pages_--;
+                disk_manager_->WritePageAsync(d.first, pg->GetData(), [this, pg, &done, &failed](int res) {
+                    // still RLatched, the frame holds the same page
+                    if(res != PAGE_SIZE) {
+                        pg->is_dirty_ = true;
+                        dirty_pages_++;
+                        failed++;
+                    }
+                    done++;
+                });
+                issued++;
+                latched.push_back(pg);
+            } else {
+                pg->RUnlatch();
+            }
+        }
+        while(done < issued) {
+            disk_manager_->PollIO(1);
+        }
+        for(Page *pg : latched) {
+            pg->RUnlatch();
+        }
+        return failed;
+    }
+    // evictable predicate: take the victim's WLatch for DeletePageCallBack
+    static bool TryLatchVictim(void *val) {
+        Page *pg = (Page *)val;
+        if(!pg->TryWLatch()) return false;
+        pg->evict_latched_ = true;
+        return true;
+    }
     void DeletePageCallBack(const Slice& k, void *val)
     {
         Page* pg = (Page*)val;
-        if(pg->IsDirty()) {
+        if(pg->evict_latched_) {
+            pg->evict_latched_ = false;
+        } else {
+            pg->WLatch();
+        }
+        if(pg->is_dirty_.exchange(false)) {
+            dirty_pages_--;
             disk_manager_->WritePage(pg->GetPageId(), pg->GetData());
         }
         pg->ResetMemory();
+        pg->page_id_ = INVALID_PAGE_ID;
+        pg->WUnlatch();
         latch_.lock();
-        free_list_.emplace_back(pg);
+        free_lists_[(pg - pages_) / node_frames_].emplace_back(pg);
         latch_.unlock();
     }
     size_t total_pages_;
     Page *pages_;
     DiskManager *disk_manager_;
     ShardedLRUCache *cache_;
-    std::list<Page *> free_list_;
-    Arena arena_;
-    // protects:free_list_
+    // frame data, one region per NUMA partition
+    std::vector<std::unique_ptr<HugePageRegion>> regions_;
+    size_t node_frames_; // frames per partition
+    std::vector<int> nodes_; // NUMA node of each partition, empty without numa_partition
+    std::vector<std::list<Page *>> free_lists_;
+    // protects:free_lists_
     std::mutex latch_;
+
+    // dirty frames, and the count that wakes the flusher
+    std::atomic<size_t> dirty_pages_{0};
+    size_t dirty_limit_ = SIZE_MAX;
+    std::thread *flusher_ = nullptr;
+    std::mutex flush_mu_;
+    std::condition_variable flush_cv_;
+    bool flush_stop_ = false;
+
+    // read-ahead
+    struct ReadStream {
+        uint32_t last = 0;
+        uint32_t run = kNoStream; // sequential steps so far
+        uint64_t next = 0; // first page not queued yet
+    };
+    static const int kReadStreams = 8;
+    static const int kStreamShards = 16;
+    static const uint32_t kNoStream = UINT32_MAX;
+    struct alignas(CACHE_LINE_SIZE) StreamShard {
+        std::mutex mu; // protects: streams, victim
+        ReadStream streams[kReadStreams];
+        size_t victim = 0;
+    };
+    std::atomic<size_t> readahead_window_{0};
+    StreamShard stream_shards_[kStreamShards];
+    std::vector<std::thread> prefetchers_;
+    std::deque<std::pair<uint32_t, bool>> prefetch_queue_; // page id, readahead
+    std::mutex prefetch_mu_;
+    std::condition_variable prefetch_cv_;
+    bool prefetch_stop_ = false;
+    std::atomic<size_t> prefetched_{0};
+    std::atomic<size_t> prefetch_hits_{0};
 };
+
+inline void PageGuard::Release()
+{
+    if (ent_ != nullptr) {
+        cache_->ReleasePage(ent_, dirty_);
+        ent_ = nullptr;
+        dirty_ = false;
+    }
+}
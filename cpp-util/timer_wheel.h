@@ -0,0 +1,157 @@
+/**
+ * hierarchical timing wheel (no thread safety, guard it with the owner's lock)
+ * kLevels wheels of kSlots slots, level L slot covers 64^L ticks. Timers are
+ * intrusive TimerNode embedded in the owner's struct, so Add/Remove are O(1)
+ * and Advance costs O(1) per tick plus the cascades and expired timers.
+ * Timers farther than the wheel span park in the last level and are
+ * re-placed when they cascade.
+ */
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+struct TimerNode
+{
+  TimerNode *prev;
+  TimerNode *next;
+  uint64_t expire; // absolute time in the caller's unit, e.g. ms
+};
+
+class TimerWheel
+{
+public:
+  // tick: length of one tick in the caller's unit, now: current time
+  TimerWheel(uint64_t tick, uint64_t now) : tick_(tick), current_(now / tick), size_(0)
+  {
+    for (int l = 0; l < kLevels; l++)
+    {
+      for (int s = 0; s < kSlots; s++)
+      {
+        slots_[l][s].prev = slots_[l][s].next = &slots_[l][s];
+      }
+    }
+  }
+  ~TimerWheel() = default;
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // n->expire must be set
+  void Add(TimerNode *n)
+  {
+    Place(n);
+    size_++;
+  }
+
+  // no-op if n is not scheduled
+  void Remove(TimerNode *n)
+  {
+    if (n->prev == nullptr)
+    {
+      return;
+    }
+    Unlink(n);
+    size_--;
+  }
+
+  // fire every timer with expire <= now, fn(node) gets an unlinked node
+  template <class F>
+  void Advance(uint64_t now, F fn)
+  {
+    const uint64_t target = now / tick_;
+    if (size_ == 0)
+    {
+      if (target >= current_)
+      {
+        current_ = target + 1;
+      }
+      return;
+    }
+    while (current_ <= target)
+    {
+      // cascade the levels whose lower level just wrapped
+      for (int l = 1; l < kLevels; l++)
+      {
+        if (((current_ >> ((l - 1) * kSlotBits)) & kMask) != 0)
+        {
+          break;
+        }
+        Cascade(&slots_[l][(current_ >> (l * kSlotBits)) & kMask]);
+      }
+      TimerNode *head = &slots_[0][current_ & kMask];
+      while (head->next != head)
+      {
+        TimerNode *n = head->next;
+        Unlink(n);
+        if (Tick(n->expire) > current_)
+        {
+          // parked beyond the wheel span
+          Place(n);
+          continue;
+        }
+        size_--;
+        fn(n);
+      }
+      current_++;
+    }
+  }
+
+  size_t Size() const { return size_; }
+
+private:
+  static const int kLevels = 4;
+  static const int kSlotBits = 6;
+  static const int kSlots = 1 << kSlotBits;
+  static const uint64_t kMask = kSlots - 1;
+
+  uint64_t Tick(uint64_t t) const { return (t + tick_ - 1) / tick_; }
+
+  void Place(TimerNode *n)
+  {
+    uint64_t expire = Tick(n->expire);
+    if (expire < current_)
+    {
+      // already due, fire on the next tick
+      expire = current_;
+    }
+    uint64_t delta = expire - current_;
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (1ULL << ((level + 1) * kSlotBits)))
+    {
+      level++;
+    }
+    const uint64_t span = 1ULL << (kLevels * kSlotBits);
+    if (delta >= span)
+    {
+      expire = current_ + span - 1;
+    }
+    TimerNode *head = &slots_[level][(expire >> (level * kSlotBits)) & kMask];
+    n->next = head;
+    n->prev = head->prev;
+    n->prev->next = n;
+    head->prev = n;
+  }
+
+  static void Unlink(TimerNode *n)
+  {
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->prev = n->next = nullptr;
+  }
+
+  void Cascade(TimerNode *head)
+  {
+    while (head->next != head)
+    {
+      TimerNode *n = head->next;
+      Unlink(n);
+      Place(n);
+    }
+  }
+
+  const uint64_t tick_;
+  uint64_t current_; // next tick to process
+  size_t size_;
+  TimerNode slots_[kLevels][kSlots];
+};
@@ -0,0 +1,181 @@
+/**
+ * TinyLFU admission filter, learn from caffeine
+ * a count-min sketch of 4-bit counters estimates how often a key hash was
+ * seen recently, a doorkeeper bitmap absorbs keys seen only once, and all
+ * counters are halved every sample_size records so old popularity fades.
+ * Record/Frequency are thread safe (lossy under races, which is fine for a sketch).
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class FrequencySketch
+{
+public:
+  // entries: expected number of distinct keys tracked
+  explicit FrequencySketch(size_t entries)
+  {
+    size_t words = 1;
+    // 16 counters per word, one word per entry like caffeine
+    while (words < entries)
+    {
+      words <<= 1;
+    }
+    table_.assign(words, 0);
+    mask_ = words - 1;
+  }
+
+  // return the new estimate
+  uint32_t Increment(uint32_t hash)
+  {
+    uint32_t min = kMaxCount;
+    for (int i = 0; i < kDepth; i++)
+    {
+      uint32_t h = Rehash(hash, i);
+      uint64_t *word = &table_[h & mask_];
+      int shift = ((h >> 28) & 15) << 2;
+      uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+      uint32_t count;
+      do
+      {
+        count = (old >> shift) & kMaxCount;
+        if (count == kMaxCount)
+        {
+          break;
+        }
+      } while (!__atomic_compare_exchange_n(word, &old, old + (1ULL << shift), true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+      count = count < kMaxCount ? count + 1 : count;
+      min = count < min ? count : min;
+    }
+    return min;
+  }
+
+  uint32_t Frequency(uint32_t hash) const
+  {
+    uint32_t min = kMaxCount;
+    for (int i = 0; i < kDepth; i++)
+    {
+      uint32_t h = Rehash(hash, i);
+      uint64_t word = __atomic_load_n(&table_[h & mask_], __ATOMIC_RELAXED);
+      uint32_t count = (word >> (((h >> 28) & 15) << 2)) & kMaxCount;
+      min = count < min ? count : min;
+    }
+    return min;
+  }
+
+  // halve every counter
+  void Age()
+  {
+    for (uint64_t &word : table_)
+    {
+      uint64_t old = __atomic_load_n(&word, __ATOMIC_RELAXED);
+      __atomic_store_n(&word, (old >> 1) & kHalfMask, __ATOMIC_RELAXED);
+    }
+  }
+
+private:
+  static const int kDepth = 4;
+  static const uint32_t kMaxCount = 15;
+  static const uint64_t kHalfMask = 0x7777777777777777ULL;
+
+  static uint32_t Rehash(uint32_t hash, int i)
+  {
+    static const uint32_t kSeeds[kDepth] = {0x97cb3127, 0xc5a9b5f3, 0x3c6ef372, 0x9e3779b9};
+    uint32_t h = (hash + kSeeds[i]) * 0x85ebca6b;
+    h ^= h >> 15;
+    h *= 0xc2b2ae35;
+    return h ^ (h >> 13);
+  }
+
+  std::vector<uint64_t> table_;
+  size_t mask_;
+};
+
+class TinyLFU
+{
+public:
+  explicit TinyLFU(size_t entries)
+      : sketch_(entries), samples_(0), sample_size_(entries < 64 ? 640 : entries * 10)
+  {
+    size_t words = 1;
+    // the doorkeeper holds the keys of one sample window, 8 bits each
+    while (words * 64 < sample_size_ * 8)
+    {
+      words <<= 1;
+    }
+    door_.assign(words, 0);
+    door_mask_ = words * 64 - 1;
+  }
+
+  // record one access of the key
+  void Record(uint32_t hash)
+  {
+    // first sighting only goes to the doorkeeper
+    if (DoorTestAndSet(hash))
+    {
+      sketch_.Increment(hash);
+    }
+    if (samples_.fetch_add(1, std::memory_order_relaxed) + 1 == sample_size_)
+    {
+      sketch_.Age();
+      for (uint64_t &w : door_)
+      {
+        __atomic_store_n(&w, 0, __ATOMIC_RELAXED);
+      }
+      samples_.fetch_sub(sample_size_ / 2, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t Frequency(uint32_t hash) const
+  {
+    return sketch_.Frequency(hash) + (DoorTest(hash) ? 1 : 0);
+  }
+
+  // admit the candidate only if it is more popular than the one it evicts
+  bool Admit(uint32_t candidate, uint32_t victim) const
+  {
+    return Frequency(candidate) > Frequency(victim);
+  }
+
+private:
+  uint32_t DoorBit(uint32_t hash, int i) const
+  {
+    uint32_t h = hash + i * ((hash >> 17) | (hash << 15)); // double hashing like BloomFilter
+    return h & door_mask_;
+  }
+  bool DoorTest(uint32_t hash) const
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      uint32_t bit = DoorBit(hash, i);
+      if (!(__atomic_load_n(&door_[bit / 64], __ATOMIC_RELAXED) & (1ULL << (bit % 64))))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+  // return whether the key was already there
+  bool DoorTestAndSet(uint32_t hash)
+  {
+    bool seen = true;
+    for (int i = 0; i < 2; i++)
+    {
+      uint32_t bit = DoorBit(hash, i);
+      uint64_t mask = 1ULL << (bit % 64);
+      if (!(__atomic_fetch_or(&door_[bit / 64], mask, __ATOMIC_RELAXED) & mask))
+      {
+        seen = false;
+      }
+    }
+    return seen;
+  }
+
+  FrequencySketch sketch_;
+  std::vector<uint64_t> door_;
+  uint32_t door_mask_;
+  std::atomic<size_t> samples_;
+  const size_t sample_size_;
+};
@@ -83,4 +83,24 @@ TEST(FixedArenaTest, AllocateAndFreeFixed) {
   EXPECT_EQ(ptrs[0], ptrs2[0]);
   EXPECT_EQ(ptrs[2], ptrs2[1]);
   EXPECT_EQ(ptrs[4], ptrs2[2]);
-}
\ No newline at end of file
+}
+
+TEST(SlabArenaTest, ReuseBySizeClass) {
+  SlabArena arena;
+  char *a = arena.AllocateSlab(40);
+  char *b = arena.AllocateSlab(100);
+  arena.FreeSlab(a, 40);
+  arena.FreeSlab(b, 100);
+  ASSERT_EQ(48 + 112, arena.FreeBytes());
+
+  // same class, same block
+  ASSERT_EQ(a, arena.AllocateSlab(33));
+  ASSERT_EQ(b, arena.AllocateSlab(112));
+  ASSERT_EQ(0, arena.FreeBytes());
+
+  // bigger than any class goes to malloc
+  const size_t usage = arena.MemoryUsage();
+  char *big = arena.AllocateSlab(SlabArena::kMaxSlab + 1);
+  arena.FreeSlab(big, SlabArena::kMaxSlab + 1);
+  ASSERT_EQ(usage, arena.MemoryUsage());
+}
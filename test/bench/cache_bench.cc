@@ -0,0 +1,386 @@
+/**
+ * trace driven cache simulator
+ * replays a key stream (a trace file, or a zipf / uniform / scan-mix
+ * generator) against ShardedLRUCache, fixed_sized_cache with every policy
+ * and PageCache, at several cache sizes and thread counts. Every access is
+ * a read-through: lookup, insert on miss. Reports hit ratio, ops/s and the
+ * per access latency percentiles (us) from Histogram.
+ *
+ * ./cache_bench --workload=zipf --keys=1000000 --ops=2000000 --theta=0.99
+ *               --sizes=1000,10000,100000 --threads=1,4
+ *               --caches=slru,lru,fifo,lfu,arc,2q,page
+ * ./cache_bench --trace=dataset.txt     one uint64 key per line, e.g. test/dataset/gen
+ */
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache/arc_cache_policy.hh"
+#include "cache/fifo_cache_policy.hh"
+#include "cache/lfu_cache_policy.hh"
+#include "cache/lru_cache_policy.hh"
+#include "cache/sharded_cache.hh"
+#include "cache/two_queue_cache_policy.hh"
+#include "histogram.h"
+#include "lrucache.h"
+#include "page_cache.h"
+
+static std::string FLAGS_trace;
+static std::string FLAGS_workload = "zipf";
+static uint64_t FLAGS_keys = 1000000;
+static uint64_t FLAGS_ops = 2000000;
+static double FLAGS_theta = 0.99;
+// share of the accesses that belong to a never ending scan (workload=scan)
+static double FLAGS_scan = 0.3;
+static std::string FLAGS_sizes = "1000,10000,100000";
+static std::string FLAGS_threads = "1,4";
+static std::string FLAGS_caches = "slru,lru,fifo,lfu,arc,2q,page";
+static uint64_t FLAGS_seed = 301;
+
+// YCSB style zipfian over [0, n), rank 0 is the hottest
+class ZipfGenerator
+{
+public:
+  ZipfGenerator(uint64_t n, double theta, uint64_t seed) : n_(n), theta_(theta), rnd_(seed)
+  {
+    zetan_ = Zeta(n, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - Zeta(2, theta) / zetan_);
+  }
+  uint64_t Next()
+  {
+    double u = dist_(rnd_);
+    double uz = u * zetan_;
+    if (uz < 1.0)
+    {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta_))
+    {
+      return 1;
+    }
+    return (uint64_t)(n_ * std::pow(eta_ * u - eta_ + 1, alpha_)) % n_;
+  }
+
+private:
+  static double Zeta(uint64_t n, double theta)
+  {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++)
+    {
+      sum += 1.0 / std::pow((double)i, theta);
+    }
+    return sum;
+  }
+
+  uint64_t n_;
+  double theta_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+  std::mt19937_64 rnd_;
+  std::uniform_real_distribution<double> dist_;
+};
+
+// spread the hot ranks over the key space (and so over the shards)
+static uint64_t Scramble(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static bool LoadTrace(const std::string &path, std::vector<uint64_t> *trace)
+{
+  FILE *fp = fopen(path.c_str(), "r");
+  if (fp == nullptr)
+  {
+    return false;
+  }
+  unsigned long key;
+  while (fscanf(fp, "%lu", &key) == 1)
+  {
+    trace->push_back(key);
+  }
+  fclose(fp);
+  return true;
+}
+
+static void Generate(std::vector<uint64_t> *trace)
+{
+  std::mt19937_64 rnd(FLAGS_seed);
+  ZipfGenerator zipf(FLAGS_keys, FLAGS_theta, FLAGS_seed);
+  std::uniform_real_distribution<double> coin;
+  uint64_t scan = 0;
+  trace->resize(FLAGS_ops);
+  for (uint64_t i = 0; i < FLAGS_ops; i++)
+  {
+    uint64_t key;
+    if (FLAGS_workload == "uniform")
+    {
+      key = Scramble(rnd() % FLAGS_keys);
+    }
+    else if (FLAGS_workload == "scan" && coin(rnd) < FLAGS_scan)
+    {
+      // scan keys live outside the zipf key range and never repeat soon
+      key = Scramble(FLAGS_keys + scan++);
+    }
+    else
+    {
+      key = Scramble(zipf.Next());
+    }
+    (*trace)[i] = key;
+  }
+}
+
+class SimCache
+{
+public:
+  virtual ~SimCache() {}
+  // lookup, insert on miss; return whether it was a hit
+  virtual bool Access(uint64_t key) = 0;
+  // caches that count hits themselves report them here
+  virtual bool TotalHits(uint64_t *) { return false; }
+};
+
+class SLruSim : public SimCache
+{
+public:
+  explicit SLruSim(size_t size) : cache_(size) {}
+  bool Access(uint64_t key) override
+  {
+    Slice k((const char *)&key, sizeof(key));
+    LRUEntry *h = cache_.Lookup(k);
+    bool hit = h != nullptr;
+    if (!hit)
+    {
+      h = cache_.Insert(k, (void *)key);
+    }
+    cache_.Release(h);
+    return hit;
+  }
+
+private:
+  ShardedLRUCache cache_;
+};
+
+template <typename Policy>
+class PolicySim : public SimCache
+{
+public:
+  // one shard single threaded, so the policy sees every key
+  PolicySim(size_t size, int threads) : cache_(size, threads == 1 ? 1 : 16) {}
+  bool Access(uint64_t key) override
+  {
+    uint64_t val;
+    if (cache_.Get(key, val))
+    {
+      return true;
+    }
+    cache_.Put(key, key);
+    return false;
+  }
+
+private:
+  sharded_fixed_sized_cache<uint64_t, uint64_t, Policy> cache_;
+};
+
+// keys are folded onto page ids, misses read 4KB from a sparse file. All
+// threads share the one PageCache and DiskManager; page I/O is positional
+// (pread/pwrite), so any --threads count runs
+class PageSim : public SimCache
+{
+public:
+  explicit PageSim(size_t size)
+  {
+    std::remove("cache_bench.db");
+    disk_.reset(new DiskManager("cache_bench.db"));
+    char page[PAGE_SIZE] = {0};
+    disk_->WritePage(kPageSpace - 1, page);
+    cache_.reset(new PageCache(size, disk_.get()));
+  }
+  ~PageSim() override
+  {
+    cache_.reset();
+    disk_->ShutDown();
+    std::remove("cache_bench.db");
+    std::remove("cache_bench.log");
+  }
+  bool Access(uint64_t key) override
+  {
+    LRUEntry *ent = cache_->FetchPage(key % kPageSpace);
+    // nullptr when the other threads pin every frame
+    if (ent != nullptr)
+    {
+      cache_->ReleasePage(ent, false);
+    }
+    return false;
+  }
+  bool TotalHits(uint64_t *hits) override
+  {
+    *hits = cache_->GetStats().hits;
+    return true;
+  }
+
+private:
+  static const uint32_t kPageSpace = 1 << 18; // 1GB sparse file
+  std::unique_ptr<DiskManager> disk_;
+  std::unique_ptr<PageCache> cache_;
+};
+
+static SimCache *NewSim(const std::string &name, size_t size, int threads)
+{
+  if (name == "slru") return new SLruSim(size);
+  if (name == "lru") return new PolicySim<LRUCachePolicy<uint64_t>>(size, threads);
+  if (name == "fifo") return new PolicySim<FIFOCachePolicy<uint64_t>>(size, threads);
+  if (name == "lfu") return new PolicySim<LFUCachePolicy<uint64_t>>(size, threads);
+  if (name == "arc") return new PolicySim<ARCCachePolicy<uint64_t>>(size, threads);
+  if (name == "2q") return new PolicySim<TwoQueueCachePolicy<uint64_t>>(size, threads);
+  if (name == "page") return new PageSim(size);
+  return nullptr;
+}
+
+static void Run(const std::string &name, size_t size, int threads, const std::vector<uint64_t> &trace)
+{
+  std::unique_ptr<SimCache> sim(NewSim(name, size, threads));
+  if (sim == nullptr)
+  {
+    fprintf(stderr, "unknown cache %s\n", name.c_str());
+    return;
+  }
+  std::vector<Histogram> hists(threads);
+  std::vector<uint64_t> hits(threads, 0);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&, t]() {
+      Histogram &hist = hists[t];
+      hist.Clear();
+      // thread t replays every threads-th access, keeping the mix of the trace
+      for (size_t i = t; i < trace.size(); i += threads)
+      {
+        auto op_start = std::chrono::steady_clock::now();
+        if (sim->Access(trace[i]))
+        {
+          hits[t]++;
+        }
+        hist.Add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - op_start).count());
+      }
+    });
+  }
+  for (auto &w : workers)
+  {
+    w.join();
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  Histogram all;
+  all.Clear();
+  uint64_t total_hits = 0;
+  for (int t = 0; t < threads; t++)
+  {
+    all.Merge(hists[t]);
+    total_hits += hits[t];
+  }
+  sim->TotalHits(&total_hits);
+  printf("%-6s %10zu %7d %9.4f %12.0f %8.2f %8.2f %8.2f\n", name.c_str(), size, threads,
+         (double)total_hits / trace.size(), trace.size() / secs, all.Percentile(50),
+         all.Percentile(99), all.Percentile(99.9));
+}
+
+static std::vector<std::string> Split(const std::string &s)
+{
+  std::vector<std::string> out;
+  size_t start = 0;
+  while (start <= s.size())
+  {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos)
+    {
+      end = s.size();
+    }
+    if (end > start)
+    {
+      out.push_back(s.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    unsigned long n;
+    double d;
+    char buf[256];
+    if (sscanf(argv[i], "--trace=%255s", buf) == 1) {
+      FLAGS_trace = buf;
+    } else if (sscanf(argv[i], "--workload=%255s", buf) == 1) {
+      FLAGS_workload = buf;
+    } else if (sscanf(argv[i], "--keys=%lu", &n) == 1) {
+      FLAGS_keys = n;
+    } else if (sscanf(argv[i], "--ops=%lu", &n) == 1) {
+      FLAGS_ops = n;
+    } else if (sscanf(argv[i], "--theta=%lf", &d) == 1) {
+      FLAGS_theta = d;
+    } else if (sscanf(argv[i], "--scan=%lf", &d) == 1) {
+      FLAGS_scan = d;
+    } else if (sscanf(argv[i], "--sizes=%255s", buf) == 1) {
+      FLAGS_sizes = buf;
+    } else if (sscanf(argv[i], "--threads=%255s", buf) == 1) {
+      FLAGS_threads = buf;
+    } else if (sscanf(argv[i], "--caches=%255s", buf) == 1) {
+      FLAGS_caches = buf;
+    } else if (sscanf(argv[i], "--seed=%lu", &n) == 1) {
+      FLAGS_seed = n;
+    } else {
+      fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<uint64_t> trace;
+  if (!FLAGS_trace.empty())
+  {
+    if (!LoadTrace(FLAGS_trace, &trace))
+    {
+      fprintf(stderr, "cannot read trace %s\n", FLAGS_trace.c_str());
+      return 1;
+    }
+    printf("trace %s: %zu accesses\n", FLAGS_trace.c_str(), trace.size());
+  }
+  else
+  {
+    Generate(&trace);
+    printf("workload %s: %zu accesses over %lu keys, theta %.2f\n", FLAGS_workload.c_str(),
+           trace.size(), (unsigned long)FLAGS_keys, FLAGS_theta);
+  }
+  if (trace.empty())
+  {
+    return 0;
+  }
+  printf("%-6s %10s %7s %9s %12s %8s %8s %8s\n", "cache", "size", "threads", "hit", "ops/s",
+         "p50(us)", "p99", "p99.9");
+  for (const std::string &size : Split(FLAGS_sizes))
+  {
+    for (const std::string &threads : Split(FLAGS_threads))
+    {
+      for (const std::string &name : Split(FLAGS_caches))
+      {
+        Run(name, std::stoul(size), std::stoi(threads), trace);
+      }
+    }
+  }
+  return 0;
+}
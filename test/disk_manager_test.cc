@@ -1,4 +1,9 @@
+#include <sys/resource.h>
+#include <atomic>
+#include <csignal>
 #include <cstring>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "disk_manager.h"
@@ -56,3 +61,302 @@ TEST_F(DiskManagerTest, ReadWriteLogTest) {
 
   dm.ShutDown();
 }
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, ConcurrentPageIOTest) {
+  DiskManager dm("test.db");
+  const int kThreads = 8;
+  const int kPages = 64;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      char data[PAGE_SIZE];
+      char buf[PAGE_SIZE];
+      // interleaved page ids, no shared cursor to race on
+      for (int i = 0; i < kPages; i++) {
+        uint32_t page_id = i * kThreads + t;
+        std::memset(data, 'a' + t, sizeof(data));
+        snprintf(data, sizeof(data), "page %u", page_id);
+        dm.WritePage(page_id, data);
+        dm.ReadPage(page_id, buf);
+        ASSERT_EQ(0, std::memcmp(buf, data, sizeof(buf)));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_TRUE(dm.Sync());
+  EXPECT_EQ(kThreads * kPages, dm.GetNumWrites());
+
+  char buf[PAGE_SIZE];
+  DiskManager reopened("test.db");
+  for (uint32_t page_id = 0; page_id < kThreads * kPages; page_id++) {
+    char expect[16];
+    snprintf(expect, sizeof(expect), "page %u", page_id);
+    reopened.ReadPage(page_id, buf);
+    ASSERT_STREQ(expect, buf);
+    ASSERT_EQ('a' + (char)(page_id % kThreads), buf[PAGE_SIZE - 1]);
+  }
+  // past the end of the file reads as zeros
+  std::memset(buf, 1, sizeof(buf));
+  reopened.ReadPage(kThreads * kPages + 10, buf);
+  char zeros[PAGE_SIZE] = {0};
+  EXPECT_EQ(0, std::memcmp(buf, zeros, sizeof(buf)));
+}
+
+static void AsyncRoundTrip(DiskManager *dm) {
+  const int kPages = 200; // more than the ring depth
+  std::vector<std::vector<char>> pages(kPages, std::vector<char>(PAGE_SIZE));
+  int written = 0;
+  for (int i = 0; i < kPages; i++) {
+    snprintf(pages[i].data(), PAGE_SIZE, "page %d", i);
+    dm->WritePageAsync(i, pages[i].data(), [&written](int res) {
+      ASSERT_EQ(PAGE_SIZE, res);
+      written++;
+    });
+  }
+  // callbacks only run from PollIO
+  while (dm->PendingIO() > 0) {
+    dm->PollIO(1);
+  }
+  ASSERT_EQ(kPages, written);
+
+  std::vector<std::vector<char>> bufs(kPages + 1, std::vector<char>(PAGE_SIZE, 1));
+  int read = 0;
+  for (int i = 0; i <= kPages; i++) {
+    dm->ReadPageAsync(i, bufs[i].data(), [&read](int) { read++; });
+  }
+  dm->SubmitIO();
+  while (read <= kPages) {
+    dm->PollIO(kPages + 1 - read);
+  }
+  for (int i = 0; i < kPages; i++) {
+    ASSERT_STREQ(pages[i].data(), bufs[i].data());
+  }
+  // past the end of the file reads as zeros
+  std::vector<char> zeros(PAGE_SIZE, 0);
+  ASSERT_EQ(zeros, bufs[kPages]);
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, AsyncIOTest) {
+  DiskManager dm("test.db");
+  bool uring = dm.EnableAsyncIO(16);
+  EXPECT_EQ(uring, dm.AsyncIOEnabled());
+  AsyncRoundTrip(&dm);
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, AsyncIOSqpollTest) {
+  bool uring = DiskManager("test.db").EnableAsyncIO(16);
+  DiskManager dm("test.db");
+  // a kernel that refuses SQPOLL still gets a plain ring
+  EXPECT_EQ(uring, dm.EnableAsyncIO(32, true));
+  AsyncRoundTrip(&dm);
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, AsyncIOThreadsTest) {
+  DiskManager dm("test.db");
+  dm.EnableAsyncIO(16);
+  const int kThreads = 4;
+  const int kPages = 100;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&dm, t]() {
+      std::vector<std::vector<char>> pages(kPages, std::vector<char>(PAGE_SIZE, 'a' + t));
+      // callbacks may run from another thread's PollIO
+      std::atomic<int> written{0};
+      for (int i = 0; i < kPages; i++) {
+        dm.WritePageAsync(t * kPages + i, pages[i].data(), [&written](int res) {
+          EXPECT_EQ(PAGE_SIZE, res);
+          written++;
+        });
+      }
+      while (written < kPages) {
+        dm.PollIO(1);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  char buf[PAGE_SIZE];
+  for (int id = 0; id < kThreads * kPages; id++) {
+    dm.ReadPage(id, buf);
+    ASSERT_EQ('a' + id / kPages, buf[0]);
+    ASSERT_EQ('a' + id / kPages, buf[PAGE_SIZE - 1]);
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, AsyncIOFallbackTest) {
+  // without EnableAsyncIO the async calls run inline
+  DiskManager dm("test.db");
+  ASSERT_FALSE(dm.AsyncIOEnabled());
+  AsyncRoundTrip(&dm);
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, DirectIOTest) {
+  DiskManager dm("test.db", true);
+  if (!dm.DirectIO()) {
+    GTEST_SKIP() << "no O_DIRECT on this filesystem";
+  }
+  // aligned buffers go straight to disk
+  Page page;
+  Page out;
+  std::strncpy(page.GetData(), "direct", PAGE_SIZE);
+  dm.WritePage(3, page.GetData());
+  dm.ReadPage(3, out.GetData());
+  EXPECT_STREQ("direct", out.GetData());
+
+  // unaligned ones are bounced
+  std::vector<char> raw(PAGE_SIZE + 1);
+  char *unaligned = raw.data() + 1;
+  std::strncpy(unaligned, "bounced", PAGE_SIZE);
+  dm.WritePage(4, unaligned);
+  std::memset(unaligned, 0, PAGE_SIZE);
+  dm.ReadPage(4, unaligned);
+  EXPECT_STREQ("bounced", unaligned);
+
+  // mixed runs fall back to single pages
+  char *const pages[] = {page.GetData(), unaligned};
+  dm.WritePages(5, pages, 2);
+  dm.ReadPage(6, out.GetData());
+  EXPECT_STREQ("bounced", out.GetData());
+
+  // Read/Append refuse unaligned requests
+  int size = dm.GetFileSize("test.db");
+  dm.Append(unaligned, PAGE_SIZE);
+  dm.Append(page.GetData(), 100);
+  EXPECT_EQ(size, dm.GetFileSize("test.db"));
+  std::memset(unaligned, 0, PAGE_SIZE);
+  dm.Read(unaligned, 0, PAGE_SIZE);
+  EXPECT_EQ(0, unaligned[0]);
+  dm.Append(page.GetData(), PAGE_SIZE);
+  EXPECT_EQ(size + PAGE_SIZE, dm.GetFileSize("test.db"));
+  dm.Read(out.GetData(), size, PAGE_SIZE);
+  EXPECT_STREQ("direct", out.GetData());
+  dm.ShutDown();
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, ShortWritePagesTest) {
+  DiskManager dm("test.db");
+  std::vector<std::vector<char>> data;
+  char *pages[4];
+  for (int i = 0; i < 4; i++) {
+    data.emplace_back(PAGE_SIZE, 'a' + i);
+    pages[i] = data[i].data();
+  }
+  // the file size limit cuts the pwritev short in the middle of page 1
+  struct rlimit saved;
+  ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &saved));
+  struct rlimit limit = saved;
+  limit.rlim_cur = PAGE_SIZE + PAGE_SIZE / 2;
+  void (*old_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+  EXPECT_FALSE(dm.WritePages(0, pages, 4));
+  setrlimit(RLIMIT_FSIZE, &saved);
+  signal(SIGXFSZ, old_handler);
+
+  ASSERT_EQ(PAGE_SIZE + PAGE_SIZE / 2, dm.GetFileSize("test.db"));
+  std::vector<char> buf(PAGE_SIZE);
+  dm.ReadPage(1, buf.data());
+  EXPECT_EQ(std::vector<char>(PAGE_SIZE / 2, 'b'), std::vector<char>(buf.begin(), buf.begin() + PAGE_SIZE / 2));
+  EXPECT_EQ(0, buf[PAGE_SIZE / 2]);
+
+  // without the limit every page lands at its own offset
+  ASSERT_TRUE(dm.WritePages(0, pages, 4));
+  for (int i = 0; i < 4; i++) {
+    dm.ReadPage(i, buf.data());
+    EXPECT_EQ(data[i], buf);
+  }
+  dm.ShutDown();
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, FreeSpaceMapTest) {
+  const uint32_t max_pages = 1 << 16;
+  char data[PAGE_SIZE] = {0};
+  {
+    DiskManager dm("test.db");
+    ASSERT_TRUE(dm.EnableFreeSpaceMap(max_pages));
+    // 8KB of bitmap after the header
+    uint32_t reserved = dm.ReservedPages();
+    EXPECT_EQ(3u, reserved);
+    for (uint32_t i = 0; i < 10; i++) {
+      uint32_t id = dm.AllocatePage();
+      EXPECT_EQ(reserved + i, id);
+      dm.WritePage(id, data);
+    }
+    // freed pages come back lowest first, reserved ones are never freed
+    dm.DeallocatePage(reserved + 6);
+    dm.DeallocatePage(reserved + 2);
+    dm.DeallocatePage(0);
+    dm.DeallocatePage(reserved + 2);
+    EXPECT_EQ(reserved + 2, dm.AllocatePage());
+
+    // the free tail goes away
+    dm.DeallocatePage(reserved + 9);
+    dm.DeallocatePage(reserved + 8);
+    EXPECT_EQ(2u, dm.Trim());
+    EXPECT_EQ((reserved + 8) * PAGE_SIZE, (uint32_t)dm.GetFileSize("test.db"));
+    EXPECT_EQ(reserved + 8, dm.NextPageId());
+    dm.ShutDown();
+  }
+  {
+    // the map survives a reopen: reserved + 6 is the only hole
+    DiskManager dm("test.db");
+    EXPECT_FALSE(dm.EnableFreeSpaceMap(max_pages * 2));
+    ASSERT_TRUE(dm.EnableFreeSpaceMap(max_pages));
+    uint32_t reserved = dm.ReservedPages();
+    EXPECT_EQ(reserved + 6, dm.AllocatePage());
+    EXPECT_EQ(reserved + 8, dm.AllocatePage());
+
+    // concurrent allocations never hand out a page twice
+    std::vector<std::vector<uint32_t>> ids(4);
+    std::vector<std::thread> threads;
+    for (auto &v : ids) {
+      threads.emplace_back([&dm, &v] {
+        for (int i = 0; i < 1000; i++) {
+          v.push_back(dm.AllocatePage());
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    std::vector<bool> seen(max_pages);
+    for (auto &v : ids) {
+      for (uint32_t id : v) {
+        ASSERT_LT(id, max_pages);
+        EXPECT_FALSE(seen[id]);
+        seen[id] = true;
+      }
+    }
+    EXPECT_EQ(reserved + 9 + 4000, dm.NextPageId());
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(DiskManagerTest, FreeSpaceMapFullTest) {
+  char data[PAGE_SIZE] = {0};
+  DiskManager plain("test.db");
+  plain.WritePage(0, data);
+  // the file exists without a map
+  EXPECT_FALSE(plain.EnableFreeSpaceMap(100));
+  plain.ShutDown();
+  remove("test.db");
+
+  DiskManager dm("test.db");
+  ASSERT_TRUE(dm.EnableFreeSpaceMap(100));
+  for (uint32_t i = dm.ReservedPages(); i < 100; i++) {
+    EXPECT_EQ(i, dm.AllocatePage());
+  }
+  EXPECT_EQ((uint32_t)INVALID_PAGE_ID, dm.AllocatePage());
+  dm.DeallocatePage(42);
+  EXPECT_EQ(42u, dm.AllocatePage());
+}
@@ -1,5 +1,8 @@
 #include "lrucache.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -46,11 +49,11 @@ class CacheTest : public testing::Test {
   }
 
   void Insert(int key, int value, int charge = 1) {
-    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value)));
+    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), charge));
   }
 
   LRUEntry* InsertAndReturnHandle(int key, int value, int charge = 1) {
-    return cache_->Insert(EncodeKey(key), EncodeValue(value));
+    return cache_->Insert(EncodeKey(key), EncodeValue(value), charge);
   }
 
   void Erase(int key) { cache_->Erase(EncodeKey(key)); }
@@ -167,25 +170,43 @@ TEST_F(CacheTest, HeavyEntries) {
   // size of items still in the cache, which must be approximately the
   // same as the total capacity.
   const int kLight = 1;
+  const int kHeavy = 10;
   int added = 0;
   int index = 0;
   while (added < 2 * kCacheSize) {
-    const int weight = kLight;
-    Insert(index, 1000 + index);
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000 + index, weight);
     added += weight;
     index++;
   }
 
   int cached_weight = 0;
   for (int i = 0; i < index; i++) {
-    const int weight = kLight;
+    const int weight = (i & 1 ? kLight : kHeavy);
     int r = Lookup(i);
     if (r >= 0) {
       cached_weight += weight;
       ASSERT_EQ(1000 + i, r);
     }
   }
-  ASSERT_LE(cached_weight, kCacheSize + kCacheSize);
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
+  ASSERT_EQ(cached_weight, cache_->TotalCharge());
+}
+
+TEST_F(CacheTest, TotalCharge) {
+  Insert(1, 100, 10);
+  Insert(2, 200, 20);
+  ASSERT_EQ(2, cache_->TotalElem());
+  ASSERT_EQ(30, cache_->TotalCharge());
+
+  // replacing a key releases the old charge
+  Insert(1, 101, 5);
+  ASSERT_EQ(2, cache_->TotalElem());
+  ASSERT_EQ(25, cache_->TotalCharge());
+
+  Erase(2);
+  ASSERT_EQ(1, cache_->TotalElem());
+  ASSERT_EQ(5, cache_->TotalCharge());
 }
 
 TEST_F(CacheTest, Prune) {
@@ -200,3 +221,671 @@ TEST_F(CacheTest, Prune) {
   ASSERT_EQ(100, Lookup(1));
   ASSERT_EQ(-1, Lookup(2));
 }
+
+TEST_F(CacheTest, MultiLookupAndInsert) {
+  std::vector<std::string> key_bufs;
+  for (int i = 0; i < 200; i++) {
+    key_bufs.push_back(EncodeKey(i));
+  }
+  std::vector<Slice> keys(key_bufs.begin(), key_bufs.end());
+  std::vector<void*> values;
+  for (int i = 0; i < 200; i++) {
+    values.push_back(EncodeValue(1000 + i));
+  }
+  std::vector<LRUEntry*> handles;
+  cache_->MultiInsert(keys, values, &handles);
+  ASSERT_EQ(200, handles.size());
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(1000 + i, DecodeValue(HandleValue(handles[i])));
+    cache_->Release(handles[i]);
+  }
+  ASSERT_EQ(200, cache_->TotalElem());
+
+  // mix hits and misses, results come back in the caller's order
+  Erase(7);
+  std::vector<std::string> probe_bufs = {EncodeKey(5), EncodeKey(7), EncodeKey(500), EncodeKey(199)};
+  std::vector<Slice> probe(probe_bufs.begin(), probe_bufs.end());
+  cache_->MultiLookup(probe, &handles);
+  ASSERT_EQ(4, handles.size());
+  ASSERT_EQ(1005, DecodeValue(HandleValue(handles[0])));
+  ASSERT_EQ(nullptr, handles[1]);
+  ASSERT_EQ(nullptr, handles[2]);
+  ASSERT_EQ(1199, DecodeValue(HandleValue(handles[3])));
+  for (LRUEntry* h : handles) {
+    if (h != nullptr) {
+      cache_->Release(h);
+    }
+  }
+}
+
+TEST_F(CacheTest, MultiInsertCharges) {
+  std::vector<std::string> key_bufs = {EncodeKey(1), EncodeKey(2), EncodeKey(1)};
+  std::vector<Slice> keys(key_bufs.begin(), key_bufs.end());
+  std::vector<void*> values = {EncodeValue(10), EncodeValue(20), EncodeValue(11)};
+  std::vector<size_t> charges = {3, 4, 5};
+  std::vector<LRUEntry*> handles;
+  cache_->MultiInsert(keys, values, &handles, &charges);
+  for (LRUEntry* h : handles) {
+    cache_->Release(h);
+  }
+  // the later duplicate replaces the first one
+  ASSERT_EQ(11, Lookup(1));
+  ASSERT_EQ(20, Lookup(2));
+  ASSERT_EQ(9, cache_->TotalCharge());
+}
+
+TEST_F(CacheTest, ExpireOnLookup) {
+  cache_->Release(cache_->Insert(EncodeKey(1), EncodeValue(101), 1, 30));
+  Insert(2, 201);
+  ASSERT_EQ(101, Lookup(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  ASSERT_EQ(-1, Lookup(1));
+  ASSERT_EQ(201, Lookup(2));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(1, deleted_keys_[0]);
+  ASSERT_EQ(1, cache_->TotalElem());
+}
+
+TEST_F(CacheTest, ExpirePinned) {
+  LRUEntry* h = cache_->Insert(EncodeKey(1), EncodeValue(101), 1, 20);
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  cache_->Expire();
+  ASSERT_EQ(0, cache_->TotalElem());
+  // the handle stays valid until released
+  ASSERT_EQ(101, DecodeValue(HandleValue(h)));
+  ASSERT_EQ(0, deleted_keys_.size());
+  cache_->Release(h);
+  ASSERT_EQ(1, deleted_keys_.size());
+}
+
+TEST(ExpiryThreadTest, ReclaimInBackground) {
+  std::atomic<int> deleted{0};
+  SLruCache cache(1000, [&](const Slice&, void*) { deleted++; });
+  cache.StartExpiry(5);
+  for (int i = 0; i < 100; i++) {
+    cache.Release(cache.Insert(EncodeKey(i), EncodeValue(i), 1, i < 50 ? 20 : 0));
+  }
+  ASSERT_EQ(100, cache.TotalElem());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // no lookup needed, expired entries no longer take capacity
+  ASSERT_EQ(50, cache.TotalElem());
+  ASSERT_EQ(50, deleted.load());
+}
+
+TEST_F(CacheTest, LookupOrLoad) {
+  Insert(1, 101);
+  int loads = 0;
+  auto loader = [&](const Slice& key, size_t* charge) -> void* {
+    loads++;
+    *charge = 2;
+    return DecodeKey(key) == 3 ? nullptr : EncodeValue(DecodeKey(key) + 100);
+  };
+  LRUEntry* h = cache_->LookupOrLoad(EncodeKey(1), loader);
+  ASSERT_EQ(101, DecodeValue(HandleValue(h)));
+  cache_->Release(h);
+  ASSERT_EQ(0, loads);
+
+  h = cache_->LookupOrLoad(EncodeKey(2), loader);
+  ASSERT_EQ(102, DecodeValue(HandleValue(h)));
+  cache_->Release(h);
+  ASSERT_EQ(1, loads);
+  ASSERT_EQ(102, Lookup(2));
+  ASSERT_EQ(3, cache_->TotalCharge());
+
+  // a failed load caches nothing
+  ASSERT_EQ(nullptr, cache_->LookupOrLoad(EncodeKey(3), loader));
+  ASSERT_EQ(-1, Lookup(3));
+}
+
+TEST(SingleFlightTest, ConcurrentMissesLoadOnce) {
+  SLruCache cache(1000);
+  std::atomic<int> loads{0};
+  const int kThreads = 8;
+  std::vector<std::thread> threads;
+  std::vector<void*> values(kThreads);
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      LRUEntry* h = cache.LookupOrLoad(EncodeKey(7), [&](const Slice&, size_t*) -> void* {
+        loads++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return EncodeValue(77);
+      });
+      values[t] = HandleValue(h);
+      cache.Release(h);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(1, loads.load());
+  for (void* v : values) {
+    ASSERT_EQ(77, DecodeValue(v));
+  }
+}
+
+TEST(EntryAllocatorTest, SteadyStateReusesEntries) {
+  LRUCache cache;
+  SlabEntryAllocator* alloc = new SlabEntryAllocator;
+  cache.SetEntryAllocator(alloc);
+  cache.SetCapacity(100);
+  cache.SetValDeleter([](const Slice&, void*) {});
+  for (int i = 0; i < 200; i++) {
+    cache.Release(cache.Insert(EncodeKey(i), i, EncodeValue(i)));
+  }
+  const size_t usage = alloc->MemoryUsage();
+  // every insert now recycles the entry it evicts
+  for (int i = 200; i < 2000; i++) {
+    cache.Release(cache.Insert(EncodeKey(i), i, EncodeValue(i)));
+  }
+  ASSERT_EQ(usage, alloc->MemoryUsage());
+  ASSERT_EQ(100, cache.TotalElem());
+}
+
+TEST(EntryAllocatorTest, Pluggable) {
+  SLruCache cache(100);
+  cache.SetEntryAllocator([]() { return new MallocEntryAllocator; });
+  cache.Release(cache.Insert(EncodeKey(1), EncodeValue(101)));
+  LRUEntry* h = cache.Lookup(EncodeKey(1));
+  ASSERT_EQ(101, DecodeValue(HandleValue(h)));
+  cache.Release(h);
+  cache.Erase(EncodeKey(1));
+  ASSERT_EQ(nullptr, cache.Lookup(EncodeKey(1)));
+}
+
+TEST_F(CacheTest, Stats) {
+  cache_->SetLockWaitSampling(1);
+  Insert(1, 101);
+  Insert(2, 102);
+  ASSERT_EQ(101, Lookup(1));
+  ASSERT_EQ(-1, Lookup(3));
+  LRUEntry* h = cache_->Lookup(EncodeKey(2));
+  cache_->Erase(EncodeKey(2));
+  cache_->Release(h);
+  cache_->Erase(EncodeKey(1));
+
+  CacheStats st = cache_->GetStats();
+  ASSERT_EQ(2, st.hits);
+  ASSERT_EQ(1, st.misses);
+  ASSERT_EQ(2, st.inserts);
+  ASSERT_EQ(0, st.evictions);
+  ASSERT_EQ(1, st.erase_pinned);
+  // 2 Insert, 3 Lookup, 3 Release, 2 Erase, each with a sampled lock
+  ASSERT_EQ(11, st.lock_wait.Count());
+
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000 + i, i);
+  }
+  std::vector<CacheStats> shards;
+  cache_->GetShardStats(&shards);
+  CacheStats merged;
+  for (const CacheStats& s : shards) {
+    merged.Merge(s);
+  }
+  ASSERT_EQ(kCacheSize + 102, merged.inserts);
+  // keys 1 and 2 were erased, not evicted
+  ASSERT_EQ(merged.inserts - 2 - cache_->TotalElem(), merged.evictions);
+  ASSERT_EQ(merged.evictions, cache_->GetStats().evictions);
+}
+
+static void EncodeInt(const Slice&, void* value, std::string* dst) {
+  PutVarint64(dst, reinterpret_cast<uintptr_t>(value));
+}
+static void* DecodeInt(const Slice&, const Slice& data) {
+  Slice in = data;
+  uint64_t v;
+  return GetVarint64(&in, &v) ? EncodeValue(v) : nullptr;
+}
+
+TEST(SnapshotTest, LRUOrder) {
+  LRUCache cache;
+  cache.SetCapacity(10);
+  cache.SetValDeleter([](const Slice&, void*) {});
+  for (int k = 1; k <= 3; k++) {
+    cache.Release(cache.Insert(EncodeKey(k), k, EncodeValue(k + 100)));
+  }
+  cache.Release(cache.Lookup(EncodeKey(1), 1));
+  std::string snap;
+  cache.Snapshot(EncodeInt, &snap);
+
+  Slice in(snap);
+  uint32_t count;
+  ASSERT_TRUE(GetVarint32(&in, &count));
+  ASSERT_EQ(3, count);
+  const int order[] = {2, 3, 1};
+  for (int k : order) {
+    Slice key, data;
+    uint64_t charge, ttl;
+    ASSERT_TRUE(GetLengthPrefixedSlice(&in, &key));
+    ASSERT_TRUE(GetVarint64(&in, &charge));
+    ASSERT_TRUE(GetVarint64(&in, &ttl));
+    ASSERT_TRUE(GetLengthPrefixedSlice(&in, &data));
+    ASSERT_EQ(k, DecodeKey(key));
+    ASSERT_EQ(1, charge);
+    ASSERT_EQ(0, ttl);
+    ASSERT_EQ(k + 100, DecodeValue(DecodeInt(key, data)));
+  }
+  ASSERT_TRUE(in.empty());
+}
+
+TEST_F(CacheTest, SaveAndLoadSnapshot) {
+  for (int i = 0; i < 200; i++) {
+    Insert(i, 1000 + i, 1 + i % 3);
+  }
+  const std::string path = testing::TempDir() + "lru_snapshot";
+  ASSERT_TRUE(cache_->SaveSnapshot(path, EncodeInt));
+
+  SLruCache warm(kCacheSize);
+  ASSERT_TRUE(warm.LoadSnapshot(path, DecodeInt));
+  ASSERT_EQ(cache_->TotalElem(), warm.TotalElem());
+  ASSERT_EQ(cache_->TotalCharge(), warm.TotalCharge());
+  for (int i = 0; i < 200; i++) {
+    LRUEntry* h = warm.Lookup(EncodeKey(i));
+    ASSERT_TRUE(h != nullptr);
+    ASSERT_EQ(1000 + i, DecodeValue(HandleValue(h)));
+    warm.Release(h);
+  }
+
+  // a truncated file is rejected
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    data.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size() / 2);
+  }
+  SLruCache broken(kCacheSize);
+  ASSERT_FALSE(broken.LoadSnapshot(path, DecodeInt));
+  std::remove(path.c_str());
+  ASSERT_FALSE(broken.LoadSnapshot(path, DecodeInt));
+}
+
+TEST_F(CacheTest, SnapshotKeepsDeadlines) {
+  cache_->Release(cache_->Insert(EncodeKey(1), EncodeValue(101), 1, 50));
+  cache_->Release(cache_->Insert(EncodeKey(2), EncodeValue(102), 1, 3600 * 1000));
+  Insert(3, 103);
+  const std::string path = testing::TempDir() + "lru_snapshot_ttl";
+  ASSERT_TRUE(cache_->SaveSnapshot(path, EncodeInt));
+  // key 1 runs out while the cache is "down"
+  std::this_thread::sleep_for(std::chrono::milliseconds(80));
+
+  SLruCache warm(kCacheSize);
+  ASSERT_TRUE(warm.LoadSnapshot(path, DecodeInt));
+  std::remove(path.c_str());
+  ASSERT_EQ(2, warm.TotalElem());
+  ASSERT_TRUE(warm.Lookup(EncodeKey(1)) == nullptr);
+  for (int k = 2; k <= 3; k++) {
+    LRUEntry* h = warm.Lookup(EncodeKey(k));
+    ASSERT_TRUE(h != nullptr);
+    ASSERT_EQ(100 + k, DecodeValue(HandleValue(h)));
+    warm.Release(h);
+  }
+}
+
+class PriorityPoolTest : public testing::Test {
+ public:
+  LRUCache cache_;
+
+  PriorityPoolTest() {
+    cache_.SetCapacity(10);
+    cache_.SetHighPriPoolRatio(0.5);
+    cache_.SetValDeleter([](const Slice&, void*) {});
+  }
+  void Insert(int key, LRUPriority pri = kLowPriority) {
+    cache_.Release(cache_.Insert(EncodeKey(key), key, EncodeValue(key), 1, 0, pri));
+  }
+  bool Lookup(int key) {
+    LRUEntry* h = cache_.Lookup(EncodeKey(key), key);
+    if (h != nullptr) {
+      cache_.Release(h);
+    }
+    return h != nullptr;
+  }
+};
+
+TEST_F(PriorityPoolTest, ScanResistant) {
+  Insert(1);
+  Insert(2);
+  Insert(3, kHighPriority);
+  // re-referenced entries are promoted to the hot segment
+  ASSERT_TRUE(Lookup(1));
+  ASSERT_TRUE(Lookup(2));
+  for (int i = 100; i < 200; i++) {
+    Insert(i);
+  }
+  ASSERT_TRUE(Lookup(1));
+  ASSERT_TRUE(Lookup(2));
+  ASSERT_TRUE(Lookup(3));
+  ASSERT_FALSE(Lookup(100));
+  ASSERT_TRUE(Lookup(199));
+  ASSERT_EQ(10, cache_.TotalElem());
+}
+
+TEST_F(PriorityPoolTest, HotSegmentIsBounded) {
+  for (int i = 0; i < 20; i++) {
+    Insert(i, kHighPriority);
+  }
+  ASSERT_EQ(10, cache_.TotalElem());
+  // demoted hot entries are evicted first, oldest first
+  ASSERT_FALSE(Lookup(9));
+  for (int i = 10; i < 20; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  // a scan keeps the newest half, the hot segment
+  for (int i = 100; i < 120; i++) {
+    Insert(i);
+  }
+  for (int i = 15; i < 20; i++) {
+    ASSERT_TRUE(Lookup(i));
+  }
+  ASSERT_FALSE(Lookup(10));
+}
+
+class AdmissionCacheTest : public CacheTest {
+ public:
+  AdmissionCacheTest() { cache_->EnableAdmission(kCacheSize); }
+};
+
+TEST_F(AdmissionCacheTest, ScanResistant) {
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000 + i);
+  }
+  for (int round = 0; round < 5; round++) {
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ(1000 + i, Lookup(i));
+    }
+  }
+  // a scan of one-hit wonders must not flush the hot keys
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(10000 + i, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+  ASSERT_LE(cache_->TotalElem(), kCacheSize + kNumShards);
+}
+
+TEST_F(AdmissionCacheTest, RejectedInsertKeepsHandle) {
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(i, 1000 + i);
+    Lookup(i);
+    Lookup(i);
+  }
+  // a new key that was never seen loses against any cached entry
+  size_t before = deleted_keys_.size();
+  LRUEntry* h = InsertAndReturnHandle(-5, 42);
+  ASSERT_EQ(42, DecodeValue(HandleValue(h)));
+  ASSERT_EQ(-1, Lookup(-5));
+  cache_->Release(h);
+  ASSERT_EQ(before + 1, deleted_keys_.size());
+  ASSERT_EQ(-5, deleted_keys_.back());
+}
+
+TEST(LRUCacheShard, LoadRecordsOneAccess) {
+  LRUCache shard;
+  shard.SetCapacity(4);
+  shard.SetAdmission(64);
+  shard.SetValDeleter([](const Slice&, void*) {});
+  auto hash = [](const std::string& k) { return Hash(k.data(), k.size(), 0); };
+  // cached keys seen twice: insert and lookup
+  for (int k = 1; k <= 4; k++) {
+    std::string key = EncodeKey(k);
+    shard.Release(shard.Insert(key, hash(key), EncodeValue(k)));
+    shard.Release(shard.Lookup(key, hash(key)));
+  }
+  ASSERT_EQ(4, shard.GetStats().inserts);
+  // a miss and then a load are two accesses, not more than the victim's
+  std::string key5 = EncodeKey(5);
+  ASSERT_TRUE(shard.Lookup(key5, hash(key5)) == nullptr);
+  LRUEntry* h = shard.LookupOrLoad(key5, hash(key5), [](const Slice&, size_t*) { return EncodeValue(5); });
+  ASSERT_TRUE(h != nullptr);
+  shard.Release(h);
+  // rejected: not cached and not counted as an insert
+  ASSERT_EQ(4, shard.GetStats().inserts);
+  ASSERT_EQ(4, shard.TotalElem());
+}
+
+TEST(LRUCacheShard, EvictOneSkipsRefused) {
+  for (bool lock_free : {false, true}) {
+    LRUCache shard;
+    shard.SetCapacity(10);
+    shard.SetLockFreeLookup(lock_free);
+    shard.SetValDeleter([](const Slice&, void*) {});
+    for (int k = 1; k <= 3; k++) {
+      std::string key = EncodeKey(k);
+      shard.Release(shard.Insert(key, Hash(key.data(), key.size(), 0), EncodeValue(k)));
+    }
+    // the oldest entry is refused, the next one goes
+    ASSERT_TRUE(shard.EvictOne(false, [](void* v) { return DecodeValue(v) != 1; }));
+    std::string key1 = EncodeKey(1), key2 = EncodeKey(2);
+    LRUEntry* h = shard.Lookup(key1, Hash(key1.data(), key1.size(), 0));
+    ASSERT_TRUE(h != nullptr);
+    shard.Release(h);
+    ASSERT_EQ(nullptr, shard.Lookup(key2, Hash(key2.data(), key2.size(), 0)));
+    ASSERT_FALSE(shard.EvictOne(false, [](void*) { return false; }));
+    ASSERT_EQ(2u, shard.TotalElem());
+  }
+}
+
+class LockFreeCacheTest : public CacheTest {
+ public:
+  LockFreeCacheTest() { cache_->SetLockFreeLookup(true); }
+};
+
+TEST_F(LockFreeCacheTest, HitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+}
+
+TEST_F(LockFreeCacheTest, EntriesArePinned) {
+  Insert(100, 101);
+  LRUEntry* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(HandleValue(h1)));
+
+  Insert(100, 102);
+  LRUEntry* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(HandleValue(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST_F(LockFreeCacheTest, EvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+  Insert(300, 301);
+  LRUEntry* h = cache_->Lookup(EncodeKey(300));
+
+  // referenced entries get a second chance, pinned ones are never evicted
+  for (int i = 0; i < kCacheSize + 200; i++) {
+    Insert(1000 + i, 2000 + i);
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(301, Lookup(300));
+  cache_->Release(h);
+  ASSERT_LE(cache_->TotalElem(), kCacheSize + kNumShards);
+}
+
+TEST_F(LockFreeCacheTest, Stats) {
+  Insert(1, 101);
+  ASSERT_EQ(101, Lookup(1));
+  ASSERT_EQ(-1, Lookup(2));
+  std::vector<LRUEntry*> handles;
+  cache_->MultiLookup({EncodeKey(1), EncodeKey(2)}, &handles);
+  cache_->Release(handles[0]);
+  CacheStats st = cache_->GetStats();
+  ASSERT_EQ(2, st.hits);
+  ASSERT_EQ(2, st.misses);
+  ASSERT_DOUBLE_EQ(0.5, st.HitRatio());
+}
+
+TEST_F(LockFreeCacheTest, MultiLookup) {
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000 + i);
+  }
+  std::vector<std::string> key_bufs;
+  for (int i = 0; i < 120; i++) {
+    key_bufs.push_back(EncodeKey(i));
+  }
+  std::vector<Slice> keys(key_bufs.begin(), key_bufs.end());
+  std::vector<LRUEntry*> handles;
+  cache_->MultiLookup(keys, &handles);
+  for (int i = 0; i < 120; i++) {
+    if (i < 100) {
+      ASSERT_EQ(1000 + i, DecodeValue(HandleValue(handles[i])));
+      cache_->Release(handles[i]);
+    } else {
+      ASSERT_EQ(nullptr, handles[i]);
+    }
+  }
+}
+
+TEST(LockFreeCacheConcurrent, LookupWhileInsert) {
+  std::atomic<int> deleted{0};
+  SLruCache cache(256, [&](const Slice&, void*) { deleted++; });
+  cache.SetLockFreeLookup(true);
+  const int kKeys = 1024;
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int k = 0; k < kKeys; k++) {
+          LRUEntry* h = cache.Lookup(EncodeKey(k));
+          if (h != nullptr) {
+            ASSERT_EQ(k, DecodeValue(HandleValue(h)));
+            cache.Release(h);
+          }
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 50; round++) {
+    for (int k = 0; k < kKeys; k++) {
+      cache.Release(cache.Insert(EncodeKey(k), EncodeValue(k)));
+      if (k % 7 == 0) {
+        cache.Erase(EncodeKey(k));
+      }
+    }
+  }
+  stop = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  ASSERT_LE(cache.TotalElem(), 256 + kNumShards);
+}
+
+TEST(LockFreeCacheConcurrent, ReclaimUnderSteadyReads) {
+  LRUCache cache;
+  cache.SetCapacity(64);
+  cache.SetLockFreeLookup(true);
+  cache.SetValDeleter([](const Slice&, void*) {});
+  const int kKeys = 256;
+  std::vector<std::string> keys;
+  for (int k = 0; k < kKeys; k++) {
+    keys.push_back(EncodeKey(k));
+  }
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  // some slot is nearly always busy
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int k = 0; k < kKeys; k++) {
+          LRUEntry* h = cache.Lookup(keys[k], Hash(keys[k].data(), keys[k].size(), 0));
+          if (h != nullptr) {
+            cache.Release(h);
+          }
+        }
+      }
+    });
+  }
+  // every insert beyond capacity retires an entry
+  for (int round = 0; round < 200; round++) {
+    for (int k = 0; k < kKeys; k++) {
+      uint32_t hash = Hash(keys[k].data(), keys[k].size(), 0);
+      cache.Release(cache.Insert(keys[k], hash, EncodeValue(k)));
+    }
+  }
+  // a burst retires faster than a busy CPU lets readers move on, but every
+  // chance they get frees the backlog
+  size_t retired = cache.RetiredEntries();
+  for (int i = 0; i < 400 && retired >= kKeys; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    for (int k = 0; k < 16; k++) {
+      uint32_t hash = Hash(keys[k].data(), keys[k].size(), 0);
+      cache.Release(cache.Insert(keys[k], hash, EncodeValue(k)));
+    }
+    retired = cache.RetiredEntries();
+  }
+  stop = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  ASSERT_LT(retired, (size_t)kKeys);
+}
+
+TEST(LRUHashTable, IncrementalRehash) {
+  HashTable table;
+  std::vector<std::string> keys;
+  std::vector<LRUEntry*> entries;
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    keys.push_back(EncodeKey(i));
+    LRUEntry* e = (LRUEntry*)malloc(sizeof(LRUEntry) - 1 + keys[i].size());
+    e->key_length = keys[i].size();
+    e->hash = Hash(keys[i].data(), keys[i].size(), 0);
+    e->next = nullptr;
+    memcpy(e->key_data, keys[i].data(), keys[i].size());
+    entries.push_back(e);
+  }
+
+  bool rehashed = false;
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(nullptr, table.Insert(entries[i]));
+    rehashed |= table.Rehashing();
+    // every key inserted so far stays reachable while buckets are moved
+    if (table.Rehashing()) {
+      for (int j = 0; j <= i; j += 97) {
+        ASSERT_EQ(entries[j], table.Lookup(keys[j], entries[j]->hash));
+        ASSERT_EQ(entries[j], table.LookupConcurrent(keys[j], entries[j]->hash));
+      }
+    }
+  }
+  ASSERT_TRUE(rehashed);
+  ASSERT_EQ(N, table.Size());
+
+  for (int i = 0; i < N; i += 2) {
+    ASSERT_EQ(entries[i], table.Remove(keys[i], entries[i]->hash));
+  }
+  for (int i = 0; i < N; i++) {
+    LRUEntry* expect = (i % 2 == 0) ? nullptr : entries[i];
+    ASSERT_EQ(expect, table.Lookup(keys[i], entries[i]->hash));
+  }
+  ASSERT_EQ(N / 2, table.Size());
+  for (LRUEntry* e : entries) {
+    free(e);
+  }
+}
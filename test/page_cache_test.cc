@@ -1,4 +1,8 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 #include "page_cache.h"
 
 class PageCacheTest : public ::testing::Test
@@ -57,3 +61,537 @@ TEST_F(PageCacheTest, lowApi)
   ASSERT_TRUE(strncmp(pg->GetData(), "hello", 5) == 0);
   pg_cache->ReleasePage(ent, false);
 }
+
+TEST_F(PageCacheTest, concurrentFetchSharesPage)
+{
+  std::vector<std::thread> threads;
+  std::vector<Page *> pages(8);
+  for (int t = 0; t < 8; t++)
+  {
+    threads.emplace_back([&, t]() {
+      LRUEntry *ent = pg_cache->FetchPage(3);
+      pages[t] = (Page *)ent->value;
+      pg_cache->ReleasePage(ent, false);
+    });
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  // every caller got the frame of the single load
+  for (Page *pg : pages)
+  {
+    ASSERT_EQ(pages[0], pg);
+  }
+  ASSERT_EQ(pg_cache->PageInCacheNum(), 1);
+}
+
+TEST_F(PageCacheTest, boundedFramePool)
+{
+  Page *frames = pg_cache->GetPages();
+  char buf[16];
+  for (uint32_t id = 0; id < 100; id++)
+  {
+    LRUEntry *ent = pg_cache->FetchPage(id);
+    ASSERT_TRUE(ent != nullptr);
+    Page *pg = (Page *)ent->value;
+    // every page lives in one of the preallocated frames
+    ASSERT_TRUE(pg >= frames && pg < frames + cache_size);
+    snprintf(pg->GetData(), sizeof(buf), "page %u", id);
+    pg_cache->ReleasePage(ent, true);
+    ASSERT_LE(pg_cache->PageInCacheNum(), cache_size);
+  }
+  // evicted dirty pages were written back
+  for (uint32_t id = 0; id < 100; id++)
+  {
+    LRUEntry *ent = pg_cache->FetchPage(id);
+    snprintf(buf, sizeof(buf), "page %u", id);
+    ASSERT_STREQ(buf, ((Page *)ent->value)->GetData());
+    pg_cache->ReleasePage(ent, false);
+  }
+}
+
+TEST_F(PageCacheTest, evictionSkipsLatchedPages)
+{
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    pg_cache->ReleasePage(pg_cache->FetchPage(id), true);
+  }
+  // page 0 is the LRU victim, latched as if the flusher were writing it
+  Page *victim = nullptr;
+  for (size_t i = 0; i < cache_size; i++)
+  {
+    if (pg_cache->GetPages()[i].GetPageId() == 0)
+    {
+      victim = &pg_cache->GetPages()[i];
+    }
+  }
+  ASSERT_TRUE(victim != nullptr);
+  victim->RLatch();
+  std::atomic<bool> done{false};
+  std::thread miss([&]() {
+    pg_cache->ReleasePage(pg_cache->FetchPage(100), false);
+    done = true;
+  });
+  for (int i = 0; i < 500 && !done; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  bool waited = !done;
+  victim->RUnlatch();
+  miss.join();
+  ASSERT_FALSE(waited);
+  ASSERT_EQ(0u, victim->GetPageId());
+}
+
+TEST_F(PageCacheTest, missWaitsOutsideShardLocks)
+{
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    pg_cache->ReleasePage(pg_cache->FetchPage(id), true);
+  }
+  // every frame is latched as if the flusher were writing them all
+  Page *frames = pg_cache->GetPages();
+  for (size_t i = 0; i < cache_size; i++)
+  {
+    frames[i].RLatch();
+  }
+  std::atomic<bool> loaded{false};
+  std::thread miss([&]() {
+    pg_cache->ReleasePage(pg_cache->FetchPage(100), false);
+    loaded = true;
+  });
+  // the waiting miss holds no shard lock, hits go through
+  std::atomic<bool> hit{false};
+  std::thread hits([&]() {
+    for (uint32_t id = 0; id < cache_size; id++)
+    {
+      pg_cache->ReleasePage(pg_cache->FetchPage(id), false);
+    }
+    hit = true;
+  });
+  for (int i = 0; i < 500 && !hit; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  bool hits_done = hit;
+  bool miss_done = loaded;
+  for (size_t i = 0; i < cache_size; i++)
+  {
+    frames[i].RUnlatch();
+  }
+  hits.join();
+  miss.join();
+  ASSERT_TRUE(hits_done);
+  ASSERT_FALSE(miss_done);
+  ASSERT_TRUE(loaded);
+}
+
+TEST_F(PageCacheTest, pinnedPagesStay)
+{
+  std::vector<LRUEntry *> pinned;
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    pinned.push_back(pg_cache->FetchPage(id));
+    ASSERT_TRUE(pinned.back() != nullptr);
+  }
+  // no frame can be stolen
+  ASSERT_EQ(nullptr, pg_cache->FetchPage(100));
+  ASSERT_EQ(nullptr, pg_cache->ReadPage(100, 0));
+
+  Page *victim = (Page *)pinned[3]->value;
+  pg_cache->ReleasePage(pinned[3], false);
+  LRUEntry *ent = pg_cache->FetchPage(100);
+  ASSERT_TRUE(ent != nullptr);
+  ASSERT_EQ(victim, (Page *)ent->value);
+  pg_cache->ReleasePage(ent, false);
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    if (id != 3)
+    {
+      ASSERT_EQ(id, ((Page *)pinned[id]->value)->GetPageId());
+      pg_cache->ReleasePage(pinned[id], false);
+    }
+  }
+}
+
+TEST_F(PageCacheTest, flushCoalescesAdjacentPages)
+{
+  char buf[16];
+  // two runs: 0..9 and 20..21
+  std::vector<uint32_t> ids = {20, 5, 0, 21, 9, 1, 2, 3, 4, 6, 7, 8};
+  for (uint32_t id : ids)
+  {
+    LRUEntry *ent = pg_cache->FetchPage(id);
+    snprintf(((Page *)ent->value)->GetData(), sizeof(buf), "page %u", id);
+    pg_cache->ReleasePage(ent, true);
+  }
+  ASSERT_EQ(ids.size(), pg_cache->DirtyPages());
+  int writes = disk_manager->GetNumWrites();
+  pg_cache->FlushAllPages();
+  ASSERT_EQ(writes + 2, disk_manager->GetNumWrites());
+  ASSERT_EQ(0u, pg_cache->DirtyPages());
+
+  // a clean release keeps pages clean, nothing left to write
+  pg_cache->FlushAllPages();
+  ASSERT_EQ(writes + 2, disk_manager->GetNumWrites());
+
+  DiskManager check(db_name);
+  char page[PAGE_SIZE];
+  for (uint32_t id : ids)
+  {
+    check.ReadPage(id, page);
+    snprintf(buf, sizeof(buf), "page %u", id);
+    ASSERT_STREQ(buf, page);
+  }
+}
+
+TEST_F(PageCacheTest, backgroundFlusher)
+{
+  // wake at 4 dirty pages, the interval alone would never fire
+  pg_cache->StartFlusher(0.25, 60 * 1000);
+  int writes = disk_manager->GetNumWrites();
+  for (uint32_t id = 0; id < 4; id++)
+  {
+    LRUEntry *ent = pg_cache->FetchPage(id);
+    snprintf(((Page *)ent->value)->GetData(), PAGE_SIZE, "page %u", id);
+    pg_cache->ReleasePage(ent, true);
+  }
+  for (int i = 0; i < 1000 && pg_cache->DirtyPages() > 0; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(0u, pg_cache->DirtyPages());
+  ASSERT_LT(disk_manager->GetNumWrites() - writes, 4);
+  pg_cache->StopFlusher();
+
+  // a restarted flusher works too
+  pg_cache->StartFlusher(0.25, 60 * 1000);
+  for (uint32_t id = 4; id < 8; id++)
+  {
+    pg_cache->ReleasePage(pg_cache->FetchPage(id), true);
+  }
+  for (int i = 0; i < 1000 && pg_cache->DirtyPages() > 0; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(0u, pg_cache->DirtyPages());
+  pg_cache->StopFlusher();
+}
+
+TEST_F(PageCacheTest, prefetch)
+{
+  char page[PAGE_SIZE] = {0};
+  for (uint32_t id = 0; id < 64; id++)
+  {
+    snprintf(page, sizeof(page), "page %u", id);
+    disk_manager->WritePage(id, page);
+  }
+  // without workers the hint is ignored
+  pg_cache->Prefetch({50});
+  ASSERT_EQ(0u, pg_cache->PageInCacheNum());
+
+  pg_cache->StartReadAhead(8, 2);
+  pg_cache->Prefetch({50, 51, 52});
+  for (int i = 0; i < 1000 && pg_cache->PrefetchedPages() < 3; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(3u, pg_cache->PrefetchedPages());
+  ASSERT_EQ(3u, pg_cache->PageInCacheNum());
+  // prefetches are not counted as fetch misses
+  CacheStats before = pg_cache->GetStats();
+  ASSERT_EQ(0u, before.hits + before.misses);
+  ASSERT_STREQ("page 51", pg_cache->ReadPage(51, 0));
+  ASSERT_EQ(before.hits + 1, pg_cache->GetStats().hits);
+  pg_cache->StopReadAhead();
+
+  // restarted workers still run, a cached page counts as a prefetch hit
+  pg_cache->StartReadAhead(8, 2);
+  pg_cache->Prefetch({52, 53});
+  for (int i = 0; i < 1000 && pg_cache->PrefetchedPages() + pg_cache->PrefetchHits() < 5; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(4u, pg_cache->PrefetchedPages());
+  ASSERT_EQ(1u, pg_cache->PrefetchHits());
+  ASSERT_EQ(1u, pg_cache->GetStats().hits + pg_cache->GetStats().misses);
+  pg_cache->StopReadAhead();
+}
+
+TEST_F(PageCacheTest, sequentialReadAhead)
+{
+  char page[PAGE_SIZE] = {0};
+  for (uint32_t id = 0; id < 64; id++)
+  {
+    snprintf(page, sizeof(page), "page %u", id);
+    disk_manager->WritePage(id, page);
+  }
+  // read-ahead stops at the allocated end
+  disk_manager->SetNextPageId(64);
+  pg_cache->StartReadAhead(4, 1);
+  // random access starts no stream
+  pg_cache->ReadPage(40, 0);
+  pg_cache->ReadPage(5, 0);
+  pg_cache->ReadPage(30, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(0u, pg_cache->PrefetchedPages());
+
+  for (uint32_t id = 0; id < 3; id++)
+  {
+    pg_cache->ReadPage(id, 0);
+  }
+  // pages 3..6 are queued, 5 is already cached
+  for (int i = 0; i < 1000 && pg_cache->PrefetchedPages() < 3; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(3u, pg_cache->PrefetchedPages());
+  char buf[16];
+  for (uint32_t id = 0; id < 48; id++)
+  {
+    snprintf(buf, sizeof(buf), "page %u", id);
+    ASSERT_STREQ(buf, pg_cache->ReadPage(id, 0));
+  }
+  // the stream keeps a window queued ahead of the scan
+  size_t prefetched = 0;
+  for (int i = 0; i < 100 && prefetched != pg_cache->PrefetchedPages(); i++)
+  {
+    prefetched = pg_cache->PrefetchedPages();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  CacheStats before = pg_cache->GetStats();
+  ASSERT_STREQ("page 48", pg_cache->ReadPage(48, 0));
+  ASSERT_EQ(before.hits + 1, pg_cache->GetStats().hits);
+  pg_cache->StopReadAhead();
+}
+
+TEST_F(PageCacheTest, readAheadStopsAtEnd)
+{
+  char page[PAGE_SIZE] = {0};
+  for (uint32_t id = 0; id < 10; id++)
+  {
+    disk_manager->WritePage(id, page);
+  }
+  disk_manager->SetNextPageId(10);
+  pg_cache->StartReadAhead(4, 1);
+  for (uint32_t id = 0; id < 10; id++)
+  {
+    pg_cache->ReadPage(id, 0);
+  }
+  size_t prefetched = SIZE_MAX;
+  for (int i = 0; i < 100 && prefetched != pg_cache->PrefetchedPages(); i++)
+  {
+    prefetched = pg_cache->PrefetchedPages();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  pg_cache->StopReadAhead();
+  // nothing past page 9 was loaded
+  ASSERT_EQ(10u, pg_cache->PageInCacheNum());
+}
+
+TEST_F(PageCacheTest, pageGuard)
+{
+  {
+    PageGuard guard = pg_cache->Pin(7);
+    ASSERT_TRUE(guard);
+    ASSERT_EQ(7u, guard.PageId());
+    snprintf(guard.Write().data(), PAGE_SIZE, "in place");
+    // pinned: cycling every other frame cannot take it
+    for (uint32_t id = 100; id < 100 + 2 * cache_size; id++)
+    {
+      pg_cache->ReadPage(id, 0);
+    }
+    ASSERT_EQ(7u, guard.PageId());
+    ASSERT_STREQ("in place", guard.Read().data());
+    ASSERT_EQ(0u, pg_cache->DirtyPages());
+  }
+  // the write view marked it dirty at release
+  ASSERT_EQ(1u, pg_cache->DirtyPages());
+
+  PageGuard a = pg_cache->Pin(8);
+  {
+    PageGuard b = pg_cache->Pin(8);
+    ASSERT_EQ(a.page(), b.page());
+    a.Read();
+  }
+  // moving transfers the pin, a read-only guard leaves the page clean
+  PageGuard c = std::move(a);
+  ASSERT_FALSE(a);
+  c.Release();
+  ASSERT_FALSE(c);
+  ASSERT_EQ(1u, pg_cache->DirtyPages());
+
+  // every frame pinned
+  std::vector<PageGuard> guards;
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    guards.push_back(pg_cache->Pin(id));
+  }
+  ASSERT_FALSE(pg_cache->Pin(200));
+  guards.clear();
+  ASSERT_TRUE(pg_cache->Pin(200));
+}
+
+TEST_F(PageCacheTest, pageGuardLatches)
+{
+  PageGuard guard = pg_cache->Pin(1);
+  std::atomic<bool> written{false};
+  std::thread writer;
+  {
+    auto view = guard.Read();
+    writer = std::thread([&]() {
+      PageGuard g = pg_cache->Pin(1);
+      auto w = g.Write();
+      snprintf(w.data(), PAGE_SIZE, "writer");
+      written = true;
+    });
+    // the writer waits for the read view
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_FALSE(written);
+    ASSERT_STREQ("", view.data());
+  }
+  writer.join();
+  ASSERT_STREQ("writer", guard.Read().data());
+}
+
+TEST_F(PageCacheTest, frameLayout)
+{
+  // metadata is a compact array, one cache line per frame
+  ASSERT_EQ(0u, sizeof(Page) % CACHE_LINE_SIZE);
+  ASSERT_LT(sizeof(Page), 256u);
+  ASSERT_NE(HugePageRegion::kNone, pg_cache->FrameBacking());
+  Page *frames = pg_cache->GetPages();
+  for (size_t i = 1; i < cache_size; i++)
+  {
+    ASSERT_EQ(frames[0].GetData() + i * PAGE_SIZE, frames[i].GetData());
+  }
+  // the data region starts on a huge page boundary
+  ASSERT_EQ(0u, (uintptr_t)frames[0].GetData() % HugePageRegion::kHugePageSize);
+
+  PageCache numa(cache_size, disk_manager, true);
+  ASSERT_GE(numa.NumaPartitions(), 1u);
+  for (uint32_t id = 0; id < 3 * cache_size; id++)
+  {
+    PageGuard guard = numa.Pin(id);
+    ASSERT_TRUE(guard);
+    snprintf(guard.Write().data(), PAGE_SIZE, "page %u", id);
+  }
+  PageGuard guard = numa.Pin(1);
+  ASSERT_STREQ("page 1", guard.Read().data());
+}
+
+TEST(HugePageRegionTest, numaNodeList)
+{
+  // node ids are taken as listed, holes included
+  ASSERT_EQ(std::vector<int>({0, 1, 4, 6, 7}), HugePageRegion::ParseNodeList("0-1,4,6-7\n"));
+  ASSERT_EQ(std::vector<int>({0}), HugePageRegion::ParseNodeList("0"));
+  ASSERT_TRUE(HugePageRegion::ParseNodeList("").empty());
+  ASSERT_FALSE(HugePageRegion::NumaNodes().empty());
+}
+
+TEST_F(PageCacheTest, asyncFlush)
+{
+  DiskManager dm("test_async.db");
+  dm.EnableAsyncIO(8);
+  {
+    PageCache cache(cache_size, &dm);
+    for (uint32_t id = 0; id < cache_size; id++)
+    {
+      PageGuard guard = cache.Pin(id * 3);
+      snprintf(guard.Write().data(), PAGE_SIZE, "page %u", id * 3);
+    }
+    ASSERT_EQ(cache_size, cache.DirtyPages());
+    cache.FlushAllPages();
+    ASSERT_EQ(0u, cache.DirtyPages());
+    ASSERT_EQ(0u, dm.PendingIO());
+  }
+  alignas(PAGE_SIZE) static char frame[PAGE_SIZE];
+  std::vector<struct iovec> bufs{{frame, PAGE_SIZE}};
+  {
+    // the first cache gave its frames back to the ring, this one holds them
+    PageCache cache(cache_size, &dm);
+    ASSERT_FALSE(dm.RegisterBuffers(bufs));
+    PageGuard guard = cache.Pin(3);
+    ASSERT_STREQ("page 3", guard.Read().data());
+  }
+  ASSERT_EQ(dm.AsyncIOEnabled(), dm.RegisterBuffers(bufs));
+  dm.UnregisterBuffers();
+  DiskManager check("test_async.db");
+  char page[PAGE_SIZE];
+  char buf[16];
+  for (uint32_t id = 0; id < cache_size; id++)
+  {
+    check.ReadPage(id * 3, page);
+    snprintf(buf, sizeof(buf), "page %u", id * 3);
+    ASSERT_STREQ(buf, page);
+  }
+  remove("test_async.db");
+  remove("test_async.log");
+}
+
+TEST_F(PageCacheTest, asyncFlushError)
+{
+  DiskManager dm("test_async.db");
+  if (!dm.EnableAsyncIO(8))
+  {
+    GTEST_SKIP() << "no io_uring";
+  }
+  {
+    PageCache cache(cache_size, &dm);
+    for (uint32_t id = 0; id < 4; id++)
+    {
+      PageGuard guard = cache.Pin(id);
+      snprintf(guard.Write().data(), PAGE_SIZE, "page %u", id);
+    }
+    // writes to the closed file fail, the pages stay dirty
+    dm.ShutDown();
+    ASSERT_FALSE(cache.FlushAllPages());
+    ASSERT_EQ(4u, cache.DirtyPages());
+  }
+  remove("test_async.db");
+  remove("test_async.log");
+}
+
+TEST_F(PageCacheTest, syncFlushError)
+{
+  DiskManager dm("test_sync.db");
+  {
+    PageCache cache(cache_size, &dm);
+    for (uint32_t id = 0; id < 4; id++)
+    {
+      PageGuard guard = cache.Pin(id);
+      snprintf(guard.Write().data(), PAGE_SIZE, "page %u", id);
+    }
+    // the pwritev of the run fails, all of its pages stay dirty
+    dm.ShutDown();
+    ASSERT_FALSE(cache.FlushAllPages());
+    ASSERT_EQ(4u, cache.DirtyPages());
+  }
+  remove("test_sync.db");
+  remove("test_sync.log");
+}
+
+TEST_F(PageCacheTest, directIO)
+{
+  DiskManager dm("test_direct.db", true);
+  {
+    PageCache cache(cache_size, &dm);
+    // twice the pool, so half of them go out through eviction
+    for (uint32_t id = 0; id < 2 * cache_size; id++)
+    {
+      PageGuard guard = cache.Pin(id);
+      snprintf(guard.Write().data(), PAGE_SIZE, "page %u", id);
+    }
+    cache.FlushAllPages();
+    char buf[16];
+    for (uint32_t id = 0; id < 2 * cache_size; id++)
+    {
+      PageGuard guard = cache.Pin(id);
+      snprintf(buf, sizeof(buf), "page %u", id);
+      ASSERT_STREQ(buf, guard.Read().data());
+    }
+  }
+  remove("test_direct.db");
+  remove("test_direct.log");
+}
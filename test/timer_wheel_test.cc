@@ -0,0 +1,52 @@
+#include "timer_wheel.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(TimerWheelTest, FireInOrder) {
+  TimerWheel wheel(1, 0);
+  // spread over every level, including beyond the wheel span
+  std::vector<uint64_t> expires = {1, 5, 63, 64, 65, 4095, 4096, 300000, 20000000};
+  std::vector<TimerNode> nodes(expires.size());
+  for (size_t i = 0; i < expires.size(); i++) {
+    nodes[i].expire = expires[i];
+    wheel.Add(&nodes[i]);
+  }
+  ASSERT_EQ(expires.size(), wheel.Size());
+
+  std::vector<uint64_t> fired;
+  uint64_t now = 0;
+  for (uint64_t target : {0ull, 4ull, 64ull, 5000ull, 299999ull, 300000ull, 20000000ull}) {
+    now = target;
+    wheel.Advance(now, [&](TimerNode* n) {
+      ASSERT_LE(n->expire, now);
+      fired.push_back(n->expire);
+    });
+    for (uint64_t e : fired) {
+      ASSERT_LE(e, now);
+    }
+  }
+  ASSERT_EQ(expires, fired);
+  ASSERT_EQ(0, wheel.Size());
+}
+
+TEST(TimerWheelTest, Remove) {
+  TimerWheel wheel(10, 1000);
+  TimerNode a{nullptr, nullptr, 1050};
+  TimerNode b{nullptr, nullptr, 1100};
+  wheel.Add(&a);
+  wheel.Add(&b);
+  wheel.Remove(&a);
+  wheel.Remove(&a);  // not scheduled any more, no-op
+  ASSERT_EQ(1, wheel.Size());
+
+  int fired = 0;
+  wheel.Advance(1099, [&](TimerNode*) { fired++; });
+  ASSERT_EQ(0, fired);
+  wheel.Advance(1100, [&](TimerNode* n) {
+    ASSERT_EQ(&b, n);
+    fired++;
+  });
+  ASSERT_EQ(1, fired);
+}